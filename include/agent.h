@@ -1,50 +1,152 @@
 #ifndef AGENT_H_
 #define AGENT_H_
 
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
 #include <utility>
+#include <vector>
 
+#include "book.h"
 #include "chess.h"
 #include "hash.h"
+#include "mcts.h"
+#include "nnue.h"
+#include "searcher.h"
+#include "tablebase.h"
+#include "time_manager.h"
 
 class Agent {
   uint32_t time_limit_;
   uint32_t time_left_;
   ChessBoard board_;
+  // The position keys of the game since its last flip or capture, board_
+  // excluded, for the searchers to detect repetitions.
+  std::vector<HashKey> game_keys_;
   ChessColor color_;
-  ChessMove best_move_;
-  TranspositionTable<20, ChessMove> table_;
+  TranspositionTable<ChessMove> table_;
+  Tablebase tablebase_;
+  OpeningBook book_;
+  // Evaluates in place of ChessBoard::Evaluate once loaded.
+  Network network_;
   int depth_limit_, num_flip_;
-  std::chrono::time_point<std::chrono::system_clock> search_start_;
-  int64_t search_counter_;
-  bool search_cut_;
 
-  static constexpr float kInf = 1E9;
-  static constexpr int kDepthLimit = 15;
-  static constexpr float kRange = 5;
-  static constexpr int kTimeThreshold = 100;
-  static constexpr int kTimeLimit = 200 * 1'000;
+  // searchers_[0] runs on the calling thread, the rest are Lazy SMP helpers
+  // that search the same position at staggered depths.
+  std::atomic<bool> stop_;
+  std::vector<std::unique_ptr<Searcher>> searchers_;
+
+  // Workers that expand chance nodes of all the searchers in parallel, each
+  // with a searcher of its own.
+  std::unique_ptr<TaskPool> pool_;
+  std::vector<std::unique_ptr<Searcher>> workers_;
+
+  // While the opponent thinks, the searchers ponder on the opponent's
+  // position, filling the shared table for every reply. Any command that
+  // changes the board or the search state stops them first.
+  bool ponder_;
+  std::vector<std::thread> ponder_threads_;
 
-  float NegaScout(float alpha, float beta, int depth, ChessColor color,
-                  bool save_move, BoardUpdater &updater);
+  TimeManager time_manager_;
+  uint64_t node_limit_;
+  SearchFeatures features_;
 
-  float ChanceNodeSearch(float alpha, float beta, int depth, ChessColor color,
-                         uint8_t pos, BoardUpdater &updater);
+  // Moves are searched by Monte Carlo tree search on as many threads as there
+  // are searchers instead of NegaScout.
+  bool use_mcts_;
+  Mcts mcts_;
 
-  std::pair<float, int> SearchSingleDepth(float alpha, float beta, int depth,
-                                          BoardUpdater &updater);
+  static constexpr float kInf = Searcher::kInf;
+  static constexpr int kDepthLimit = 15;
+  static constexpr float kRange = 5;
+
+  ChessMove SearchNegaScout();
+  ChessMove SearchMcts();
+  void HelperSearch(size_t id);
+  void RebuildTaskPool(size_t num_workers);
+  void StartPondering();
+  // Logs the statistics of the search that just ended as a JSON line, given
+  // the depth, milliseconds and cumulative nodes of the main thread after each
+  // completed iteration.
+  void PrintStats(
+      float score, int depth,
+      const std::vector<std::tuple<int, int, uint64_t>> &iterations) const;
 
  public:
   explicit Agent();
   explicit Agent(const ChessBoard &board, ChessColor color);
+  ~Agent();
+  Agent(const Agent &) = delete;
+  Agent &operator=(const Agent &) = delete;
 
   void MakeMove(uint8_t src, uint8_t dst);
   void MakeFlip(uint8_t pos, ChessPiece result);
   ChessMove GenerateMove();
   void TraceMoves();
+  void StopPondering();
+
+  // Applies an engine option, either from the command line (--name=value) or
+  // from the MGTP setoption command. Returns false if the name is unknown.
+  bool SetOption(std::string_view name, std::string_view value);
 
   void SetTimeLimit(uint32_t tl) { time_limit_ = tl; }
   void SetTimeLeft(uint32_t tl) { time_left_ = tl; }
-  void Reset() { board_ = ChessBoard(); }
+  void Reset() {
+    StopPondering();
+    board_ = ChessBoard();
+    game_keys_.clear();
+    table_.Clear();
+  }
+  void SetTableSize(size_t size_mb) {
+    StopPondering();
+    table_.Resize(size_mb);
+  }
+  // Maps the endgame tablebases of dir and returns the number of tables.
+  size_t LoadTablebase(const std::string &dir) {
+    StopPondering();
+    return tablebase_.Load(dir);
+  }
+  // Maps the opening book at path. Returns false if it cannot be loaded.
+  bool LoadBook(const std::string &path) { return book_.Load(path); }
+  // Maps the network file at path for the searches to evaluate with, or
+  // goes back to ChessBoard::Evaluate if path is empty or "none". Returns
+  // false if the network cannot be loaded, which also unloads the previous
+  // one.
+  bool LoadNetwork(const std::string &path) {
+    StopPondering();
+    if (path.empty() || path == "none") {
+      network_.Unload();
+      return true;
+    }
+    return network_.Load(path);
+  }
+  void SetNumThreads(size_t num_threads);
+  void SetNumChanceThreads(size_t num_threads) {
+    StopPondering();
+    RebuildTaskPool(num_threads);
+  }
+  void SetPonder(bool ponder) {
+    StopPondering();
+    ponder_ = ponder;
+  }
+  // Spends a fixed number of milliseconds on every move instead of budgeting
+  // the clock, if positive.
+  void SetMoveTime(int ms) { time_manager_.SetMoveTime(ms); }
+  // Stops every move after the main thread searched this many nodes, or after
+  // this many MCTS iterations, if positive. The search then goes on until the
+  // limit is hit.
+  void SetNodeLimit(uint64_t nodes) { node_limit_ = nodes; }
+  void SetMcts(bool use_mcts) {
+    StopPondering();
+    use_mcts_ = use_mcts;
+  }
+  void SetMctsSize(size_t size_mb) { mcts_.Resize(size_mb); }
+  void SetMctsPlayouts(bool playouts) { mcts_.SetPlayouts(playouts); }
+  // Switches the selective search of every searcher.
+  void SetSearchFeatures(const SearchFeatures &features);
   void SetColor(ChessColor c) { color_ = c; }
 
   constexpr ChessColor GetColor() const { return color_; }
@@ -0,0 +1,92 @@
+#ifndef BATCH_EVAL_H_
+#define BATCH_EVAL_H_
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "chess.h"
+
+// The weights of ChessBoard::Evaluate as a vector of parameters, so that they
+// can be changed at run time and tuned.
+struct EvalWeights {
+  enum Index : size_t {
+    // The values of the pieces, indexed by their kinds.
+    kSoldier,
+    kCannon,
+    kHorse,
+    kChariot,
+    kElephant,
+    kAdvisor,
+    kGeneral,
+    // The values of soldiers and cannons once the opponent's general is
+    // revealed, and while it is still covered.
+    kSoldierRevealed,
+    kCannonRevealed,
+    kSoldierCovered,
+    kCannonCovered,
+    // A covered piece is worth its value divided by kCoefCovered, and a piece
+    // under attack its value divided by kCoefDangerous.
+    kCoefCovered,
+    kCoefDangerous,
+    kDominateScore,
+    kNumWeights
+  };
+
+  std::array<float, kNumWeights> values;
+
+  // The weights ChessBoard::Evaluate is built with.
+  static EvalWeights Default();
+};
+
+// Prints the weights as the constants of ChessBoard.
+std::ostream &operator<<(std::ostream &os, const EvalWeights &weights);
+
+// Scores many positions at once with any weights, for tuning. Given the two
+// coefficients, ChessBoard::Evaluate is linear in the piece values, so Add
+// reduces a position to the counts those are multiplied by. The counts are
+// stored as a structure of arrays, one array per value with an entry per
+// position, so that Evaluate and AddGradient stream through contiguous memory
+// and the compiler vectorizes their loops over positions.
+class BatchEvaluator {
+  // The weights that are piece values.
+  static constexpr size_t kNumValues = EvalWeights::kCoefCovered;
+  // The positions are processed in blocks whose scores stay in L1.
+  static constexpr size_t kBlockSize = 1024;
+
+  // For each value, the number of pieces of RED minus those of BLACK that are
+  // worth it: uncovered, covered, and uncovered under attack.
+  std::array<std::vector<int8_t>, kNumValues> uncovered_;
+  std::array<std::vector<int8_t>, kNumValues> covered_;
+  std::array<std::vector<int8_t>, kNumValues> attacked_;
+  // The factor the no-flip/capture counter scales the score by, 0 when a
+  // piece dominates.
+  std::vector<float> scale_;
+  // When a piece dominates, kDominateScore times this is the score: 1 / (the
+  // number of pieces left to the opponent + 1), negative for BLACK.
+  std::vector<float> dominance_;
+
+  // Scores the positions [begin, begin + n) for RED, n <= kBlockSize.
+  void EvaluateBlock(const EvalWeights &weights, size_t begin, size_t n,
+                     float *scores) const;
+
+ public:
+  // Appends the board.
+  void Add(const ChessBoard &board);
+  size_t GetSize() const { return scale_.size(); }
+
+  // Stores in scores the evaluation for RED of the positions [begin, end),
+  // equal to ChessBoard::Evaluate(RED) with the default weights.
+  void Evaluate(const EvalWeights &weights, size_t begin, size_t end,
+                float *scores) const;
+  // Adds to *gradient the gradient with respect to the weights of the sum of
+  // derivatives[i] times the score of position begin + i over [begin, end),
+  // which is the gradient of a loss given its derivatives by the scores.
+  void AddGradient(
+      const EvalWeights &weights, size_t begin, size_t end,
+      const float *derivatives,
+      std::array<double, EvalWeights::kNumWeights> *gradient) const;
+};
+
+#endif  // BATCH_EVAL_H_
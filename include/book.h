@@ -0,0 +1,65 @@
+#ifndef BOOK_H_
+#define BOOK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "chess.h"
+
+// The move chosen for a position by a search of the given depth.
+struct BookEntry {
+  uint64_t key;
+  float score;
+  ChessMove move;
+  uint8_t depth;
+  uint8_t padding;
+};
+
+static_assert(sizeof(BookEntry) == 16,
+              "book entries are expected to be packed");
+
+// An opening book of the early positions, searched offline (see bookgen.cpp)
+// and memory-mapped from disk.
+//
+// A book file starts with kMagic, the width of the Zobrist keys it was built
+// with and the number of entries, followed by the entries sorted by key.
+class OpeningBook {
+  const BookEntry *entries_;
+  size_t num_entries_;
+  void *mapping_;
+  size_t mapping_size_;
+
+  void Unload();
+
+ public:
+  static constexpr char kMagic[4] = {'C', 'D', 'O', 'B'};
+  static constexpr size_t kHeaderSize = 16;
+
+  // The Zobrist key of the board as stored in the book. Keys of 64-bit and
+  // 128-bit builds differ, so a book only loads in builds of its key width.
+  static uint64_t GetKey(const ChessBoard &board) {
+    return static_cast<uint64_t>(board.GetHashValue());
+  }
+
+  // Sorts the entries and writes them to path. Returns false on failure.
+  static bool Write(const std::string &path, std::vector<BookEntry> entries);
+
+  OpeningBook();
+  ~OpeningBook();
+  OpeningBook(const OpeningBook &) = delete;
+  OpeningBook &operator=(const OpeningBook &) = delete;
+
+  // Maps the book file at path, replacing the book loaded before. Returns
+  // false if the file cannot be mapped or is not a book of this build.
+  bool Load(const std::string &path);
+
+  // Sets *mv to the book move of the board, the player to move being part of
+  // the key. Returns false if the board is not in the book.
+  bool Probe(const ChessBoard &board, ChessMove *mv) const;
+
+  size_t GetNumEntries() const { return num_entries_; }
+};
+
+#endif  // BOOK_H_
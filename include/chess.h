@@ -2,11 +2,10 @@
 #define CHESS_H_
 
 #include <array>
+#include <cassert>
 #include <cstdint>
 #include <ostream>
 #include <string>
-#include <variant>
-#include <vector>
 
 #include "hash.h"
 
@@ -50,32 +49,118 @@ enum ChessPiece : uint8_t {
   COVERED_PIECE = 15,
 };
 
-constexpr ChessPiece GetChessPieceType(ChessPiece piece);
-constexpr ChessColor GetChessPieceColor(ChessPiece piece);
-bool CanCapture(ChessPiece capturer, ChessPiece capturee);
+constexpr ChessPiece GetChessPieceType(ChessPiece piece) {
+  uint8_t p = piece;
+  if (p >= kNumChessPieces) p -= kNumChessPieces;
+  return ChessPiece(p);
+}
 
-struct Move {
-  uint8_t src;
-  uint8_t dst;
+constexpr ChessColor GetChessPieceColor(ChessPiece piece) {
+  return ChessColor(piece >= kNumChessPieces);
+}
 
-  Move() = default;
-  Move(uint8_t s, uint8_t d) : src(s), dst(d) {}
-};
+constexpr std::array<std::array<bool, 16>, 16> BuildCaptureTable() {
+  std::array<std::array<bool, 16>, 16> table{};
+  for (uint8_t i = 0; i < 2 * kNumChessPieces; ++i) {
+    table[i][NO_PIECE] = true;
+    for (uint8_t j = 0; j < 2 * kNumChessPieces; ++j) {
+      auto capturer = ChessPiece(i), capturee = ChessPiece(j);
+      if (GetChessPieceColor(capturer) == GetChessPieceColor(capturee))
+        continue;
+      capturer = GetChessPieceType(capturer);
+      capturee = GetChessPieceType(capturee);
+      if (capturer == GENERAL && capturee == SOLDIER) continue;
+      table[i][j] = (capturer == SOLDIER && capturee == GENERAL) ||
+                    capturer == CANNON || capturer >= capturee;
+    }
+  }
+  return table;
+}
+
+constexpr std::array<std::array<bool, 16>, 16> kCaptureTable =
+    BuildCaptureTable();
+
+inline bool CanCapture(ChessPiece capturer, ChessPiece capturee) {
+  return kCaptureTable[capturer][capturee];
+}
+
+// A move packed into 16 bits: bits 0-4 hold the source square, bits 5-9 the
+// destination square (equal to the source for flips), bit 10 marks a flip and
+// bits 11-14 hold the revealed piece. The all-zero value is the null move.
+class ChessMove {
+  uint16_t data_;
+
+  constexpr explicit ChessMove(uint16_t data) : data_(data) {}
 
-struct Flip {
-  uint8_t pos;
-  ChessPiece result;
+  friend constexpr ChessMove Move(uint8_t src, uint8_t dst);
+  friend constexpr ChessMove Flip(uint8_t pos, ChessPiece result);
 
-  Flip() = default;
-  Flip(uint8_t p) : pos(p), result(COVERED_PIECE) {}
-  Flip(uint8_t p, ChessPiece r) : pos(p), result(r) {}
+ public:
+  constexpr ChessMove() : data_(0) {}
+
+  constexpr uint8_t GetSrc() const { return data_ & 31; }
+  constexpr uint8_t GetDst() const { return data_ >> 5 & 31; }
+  constexpr uint8_t GetPos() const { return GetSrc(); }
+  constexpr bool IsFlip() const { return data_ >> 10 & 1; }
+  constexpr ChessPiece GetResult() const { return ChessPiece(data_ >> 11); }
+  constexpr bool IsNull() const { return data_ == 0; }
+  constexpr uint16_t GetData() const { return data_; }
+
+  constexpr bool operator==(const ChessMove &other) const {
+    return data_ == other.data_;
+  }
+  constexpr bool operator!=(const ChessMove &other) const {
+    return data_ != other.data_;
+  }
 };
 
-using ChessMove = std::variant<Move, Flip>;
+constexpr ChessMove Move(uint8_t src, uint8_t dst) {
+  return ChessMove(static_cast<uint16_t>(src | dst << 5));
+}
+
+constexpr ChessMove Flip(uint8_t pos, ChessPiece result = COVERED_PIECE) {
+  return ChessMove(
+      static_cast<uint16_t>(pos | pos << 5 | 1 << 10 | result << 11));
+}
 
 std::ostream &operator<<(std::ostream &os, const ChessMove &mv);
-std::ostream &operator<<(std::ostream &os, const Move &mv);
-std::ostream &operator<<(std::ostream &os, const Flip &fp);
+
+// A vector with a fixed capacity stored inline, so that it never allocates.
+template <class T, size_t N>
+class FixedVector {
+  std::array<T, N> data_;
+  size_t size_;
+
+ public:
+  FixedVector() : size_(0) {}
+
+  void push_back(const T &v) {
+    assert(size_ < N);
+    data_[size_++] = v;
+  }
+  void pop_back() {
+    assert(size_ > 0);
+    size_--;
+  }
+  void clear() { size_ = 0; }
+
+  T &back() { return data_[size_ - 1]; }
+  const T &back() const { return data_[size_ - 1]; }
+  T &operator[](size_t i) { return data_[i]; }
+  const T &operator[](size_t i) const { return data_[i]; }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  T *begin() { return data_.data(); }
+  T *end() { return data_.data() + size_; }
+  const T *begin() const { return data_.data(); }
+  const T *end() const { return data_.data() + size_; }
+};
+
+// Upper bound of the number of moves (excluding flips) in any position.
+constexpr size_t kMaxMoves = 128;
+using MoveList = FixedVector<ChessMove, kMaxMoves>;
 
 class BoardUpdater;  // forward declaration
 
@@ -120,89 +205,339 @@ constexpr std::array<char, 2 * kNumChessPieces + 2> BuildPieceCharMapping() {
   mapping[BLACK_GENERAL] = 'k';
   return mapping;
 }
-class ChessBoard {
+
+// Bit masks of the (at most four) squares orthogonally adjacent to each square.
+constexpr std::array<uint32_t, 32> BuildNeighborMasks() {
+  std::array<uint32_t, 32> masks{};
+  for (int p = 0; p < 32; ++p) {
+    if (p >= 4) masks[p] |= 1U << (p - 4);
+    if (p < 28) masks[p] |= 1U << (p + 4);
+    if (p % 4 > 0) masks[p] |= 1U << (p - 1);
+    if (p % 4 < 3) masks[p] |= 1U << (p + 1);
+  }
+  return masks;
+}
+
+// For a line of L squares, maps (position, occupancy of the line) to the mask
+// of squares a cannon can jump onto, i.e. the first occupied square behind the
+// first screen in each direction.
+template <size_t L>
+constexpr std::array<std::array<uint8_t, (1 << L)>, L> BuildCannonTargets() {
+  std::array<std::array<uint8_t, (1 << L)>, L> targets{};
+  for (int i = 0; i < static_cast<int>(L); ++i) {
+    for (int occ = 0; occ < (1 << L); ++occ) {
+      for (int d : {-1, 1}) {
+        int x = i + d;
+        while (x >= 0 && x < static_cast<int>(L) && !(occ >> x & 1)) x += d;
+        for (x += d; x >= 0 && x < static_cast<int>(L); x += d) {
+          if (occ >> x & 1) {
+            targets[i][occ] |= 1 << x;
+            break;
+          }
+        }
+      }
+    }
+  }
+  return targets;
+}
+
+// Spreads an 8-bit mask of rows to the squares of the first column.
+constexpr std::array<uint32_t, 256> BuildFileSpread() {
+  std::array<uint32_t, 256> spread{};
+  for (int m = 0; m < 256; ++m) {
+    for (int r = 0; r < 8; ++r) {
+      if (m >> r & 1) spread[m] |= 1U << (4 * r);
+    }
+  }
+  return spread;
+}
+
+// A packed array of N 4-bit values.
+template <size_t N>
+class NibbleArray {
+  std::array<uint64_t, (N + 15) / 16> words_{};
+
+ public:
+  constexpr uint8_t Get(size_t i) const {
+    return words_[i / 16] >> (i % 16 * 4) & 0xF;
+  }
+
+  constexpr void Set(size_t i, uint8_t v) {
+    uint64_t &word = words_[i / 16];
+    word = (word & ~(uint64_t(0xF) << (i % 16 * 4))) |
+           uint64_t(v) << (i % 16 * 4);
+  }
+
+  // Adds d to the i-th value, which must stay within [0, 16).
+  constexpr void Add(size_t i, int d) {
+    words_[i / 16] += uint64_t(int64_t(d)) << (i % 16 * 4);
+  }
+
+  // Returns the mask of the indices whose values differ from those of other,
+  // for N <= 32.
+  constexpr uint32_t GetChanged(const NibbleArray &other) const {
+    uint32_t mask = 0;
+    for (size_t w = 0; w < words_.size(); ++w) {
+      // Gather a bit per nibble at the bottom of the nibble.
+      uint64_t x = words_[w] ^ other.words_[w];
+      x |= x >> 2;
+      x |= x >> 1;
+      for (x &= 0x1111111111111111; x > 0; x &= x - 1)
+        mask |= 1U << (w * 16 + __builtin_ctzll(x) / 4);
+    }
+    return mask;
+  }
+
+  // Returns the sum of the values in [begin, end), which must lie in the same
+  // 64-bit word.
+  constexpr uint32_t Sum(size_t begin, size_t end) const {
+    assert(begin / 16 == (end - 1) / 16);
+    uint64_t x = words_[begin / 16] >> (begin % 16 * 4);
+    if (end - begin < 16) x &= (uint64_t(1) << ((end - begin) * 4)) - 1;
+    x = (x & 0x0F0F0F0F0F0F0F0F) + (x >> 4 & 0x0F0F0F0F0F0F0F0F);
+    return x * 0x0101010101010101 >> 56;
+  }
+};
+
+// The whole state fits in a cache line, so that copying a board is as cheap
+// as undoing a move.
+class alignas(64) ChessBoard {
   static constexpr size_t kNumSquares = 32;
-  std::array<ChessPiece, kNumSquares> board_;
-  std::array<uint8_t, kNumChessPieces * 2> covered_;
-  std::array<uint8_t, 2> num_covered_pieces_;
-  std::array<uint8_t, 2> num_pieces_left_;
+
+  // The hash covers the squares, the player to move, the pool of covered
+  // pieces and the no-flip/capture counter.
+  HashKey hash_value_;
+  NibbleArray<kNumSquares> board_;
+  // The number of covered pieces of each kind.
+  NibbleArray<kNumChessPieces * 2> covered_;
+  // The number of uncovered pieces of each kind, maintained incrementally by
+  // UpdateBoard. A general is revealed iff its count is positive.
+  NibbleArray<kNumChessPieces * 2> piece_counts_;
   std::array<uint32_t, 2> uncovered_squares_;
   uint32_t covered_squares_;
 
-  static constexpr uint32_t kNoFlipCaptureCountLimit = 60;
-  uint32_t no_flip_capture_count_;
+  static constexpr uint8_t kNoFlipCaptureCountLimit = 60;
+  uint8_t no_flip_capture_count_;
 
   ChessColor current_player_;
 
-  using uint128_t = unsigned __int128;
-  uint128_t hash_value_;
-  ZobristHash<kNumSquares, kNumChessPieces * 2 + 2, 3> hasher_;
+  static constexpr float kCoefDangerous = 3;
+  static constexpr float kCoefCovered = 5;
+  static constexpr float kDominateScore = 10000;
+  // The values of soldiers and cannons once the opponent's general is
+  // revealed, and while it is still covered.
+  static constexpr float kSoldierValueRevealed = 20;
+  static constexpr float kCannonValueRevealed = 250;
+  static constexpr float kSoldierValueCovered = 10;
+  static constexpr float kCannonValueCovered = 200;
+
+  static constexpr auto kPieceKeys =
+      BuildZobristTable<kNumSquares, kNumChessPieces * 2 + 2>(0x7122);
+  static constexpr auto kPlayerKeys = BuildZobristTable<1, 3>(0x7123)[0];
+  static constexpr auto kCoveredKeys =
+      BuildZobristTable<kNumChessPieces * 2, 6>(0x7124);
+  static constexpr auto kNoFlipCaptureKeys =
+      BuildZobristTable<1, kNoFlipCaptureCountLimit + 1>(0x7125)[0];
 
   friend class BoardUpdater;
+  friend class PlayoutBoard;
+  friend struct EvalWeights;
 
   static constexpr std::array<ChessPiece, 128> kCharPieceMapping =
       BuildCharPieceMapping();
   static constexpr std::array<char, kNumChessPieces * 2 + 2> kPieceCharMapping =
       BuildPieceCharMapping();
 
+  static constexpr std::array<uint32_t, kNumSquares> kNeighborMasks =
+      BuildNeighborMasks();
+  static constexpr std::array<std::array<uint8_t, 16>, 4> kCannonRankTargets =
+      BuildCannonTargets<4>();
+  static constexpr std::array<std::array<uint8_t, 256>, 8> kCannonFileTargets =
+      BuildCannonTargets<8>();
+  static constexpr std::array<uint32_t, 256> kFileSpread = BuildFileSpread();
+
   void UpdateBoard(uint8_t pos, ChessPiece piece);
   void UpdatePlayer(ChessColor new_player);
-
-  uint8_t GetCannonTarget(ChessColor color, uint8_t pos, int d) const;
-  uint32_t MarkUnderAttack() const;
+  void UpdateCovered(ChessPiece piece, uint8_t count);
+  void UpdateNoFlipCaptureCount(uint8_t count);
+  HashKey ComputeHashValue() const;
+  static std::array<ChessPiece, kNumSquares> ParseSquares(
+      const std::array<std::string, 8> &buffer);
+
+  uint8_t GetNumPiecesLeft(ChessColor c) const;
+
+#ifndef NDEBUG
+  // Evaluates the board from scratch, to cross-check Evaluate.
+  float EvaluateFull(ChessColor color) const;
+#endif
+
+  // Returns the mask of occupied squares the cannon at pos can jump onto.
+  uint32_t GetCannonTargets(uint8_t pos) const {
+    return GetCannonTargets(pos, covered_squares_ | uncovered_squares_[RED] |
+                                     uncovered_squares_[BLACK]);
+  }
+  // The same, given the mask of occupied squares.
+  static uint32_t GetCannonTargets(uint8_t pos, uint32_t occupied);
 
  public:
+  static constexpr std::array<float, kNumChessPieces> kPieceValue = {
+      1, 180, 6, 18, 90, 270, 810};
   explicit ChessBoard();
   explicit ChessBoard(const std::array<std::string, 8> &buffer,
                       const std::array<uint8_t, kNumChessPieces * 2> &covered,
-                      ChessColor current_player);
-
-  std::vector<ChessMove> ListMoves(ChessColor player);
-  void MakeMove(const ChessMove &mv, BoardUpdater *updater = nullptr);
+                      ChessColor current_player,
+                      uint8_t no_flip_capture_count = 0);
+  explicit ChessBoard(const std::array<ChessPiece, kNumSquares> &squares,
+                      const std::array<uint8_t, kNumChessPieces * 2> &covered,
+                      ChessColor current_player,
+                      uint8_t no_flip_capture_count = 0);
+
+  // Appends the capturing moves of the player to moves.
+  void ListCaptures(ChessColor player, MoveList *moves) const;
+  // Appends the non-capturing moves (flips excluded) of the player to moves.
+  void ListQuiets(ChessColor player, MoveList *moves) const;
+  // Returns all the moves (flips excluded), captures first by MVV-LVA.
+  MoveList ListMoves(ChessColor player) const;
+
+  void MakeMove(ChessMove mv, BoardUpdater *updater = nullptr);
+  // Passes the turn, for null-move pruning. A pass counts towards the
+  // no-flip/capture rule like a quiet move.
+  void MakeNullMove(BoardUpdater *updater = nullptr);
+
+  // Returns the mask of the uncovered pieces of either color that the
+  // opponent can capture.
+  uint32_t MarkUnderAttack() const;
 
   constexpr uint32_t GetCoveredSquares() const { return covered_squares_; }
+  constexpr uint32_t GetUncoveredSquares(ChessColor c) const {
+    return uncovered_squares_[c];
+  }
 
-  constexpr uint8_t GetNumCoveredPieces(ChessColor c) const {
-    return num_covered_pieces_[c];
+  constexpr ChessPiece GetPiece(uint8_t pos) const {
+    return ChessPiece(board_.Get(pos));
+  }
+  // The character of the piece in the text format of debug.cpp.
+  static constexpr char GetPieceChar(ChessPiece piece) {
+    return kPieceCharMapping[piece];
+  }
+
+  // Most valuable victim first, least valuable attacker as the tie breaker.
+  float GetCaptureScore(ChessMove mv) const {
+    return kPieceValue[GetChessPieceType(GetPiece(mv.GetDst()))] * 1024 -
+           kPieceValue[GetChessPieceType(GetPiece(mv.GetSrc()))];
   }
 
-  constexpr uint128_t GetHashValue() const { return hash_value_; }
+  constexpr uint8_t GetNumCoveredPieces(ChessColor c) const {
+    return covered_.Sum(c * kNumChessPieces, (c + 1) * kNumChessPieces);
+  }
 
-  const std::array<uint8_t, kNumChessPieces * 2> &GetCoveredPieces() const {
-    return covered_;
+  constexpr HashKey GetHashValue() const { return hash_value_; }
+  // The hash without the no-flip/capture counter, equal for positions that
+  // repeat one another.
+  constexpr HashKey GetPositionKey() const {
+    return hash_value_ ^ kNoFlipCaptureKeys[no_flip_capture_count_ <
+                                                    kNoFlipCaptureCountLimit
+                                                ? no_flip_capture_count_
+                                                : kNoFlipCaptureCountLimit];
+  }
+  // The player to move, UNKNOWN before the first flip.
+  constexpr ChessColor GetCurrentPlayer() const { return current_player_; }
+
+  std::array<uint8_t, kNumChessPieces * 2> GetCoveredPieces() const;
+  // The masks of the squares and of the kinds of covered pieces that differ
+  // from those of other, for incremental updates of an evaluation.
+  constexpr uint32_t GetChangedSquares(const ChessBoard &other) const {
+    return board_.GetChanged(other.board_);
+  }
+  constexpr uint32_t GetChangedCovered(const ChessBoard &other) const {
+    return covered_.GetChanged(other.covered_);
   }
 
   bool Terminate() const;
   ChessColor GetWinner() const;
   float Evaluate(ChessColor color) const;
-  bool Playable(const ChessMove &mv) const;
+  // Whether, with no covered pieces left, an uncovered piece dominates all
+  // the pieces of the opponent's, which Evaluate scores as a win. Sets *color
+  // to the color of the first such piece and *num_left to the number of
+  // pieces its opponent has left.
+  bool FindDominance(ChessColor *color, uint8_t *num_left) const;
+  bool Playable(ChessMove mv) const;
+  // The value of the piece given the state of the opponent's general.
+  float GetPieceValue(ChessPiece piece) const;
+  // The material the player to move wins by the capture mv and the best
+  // sequence of recaptures on its destination, either side free to stop.
+  // Cannons recapture through the screens left by the pieces that moved.
+  float StaticExchange(ChessMove mv) const;
 
   uint32_t GetNoFlipCaptureCount() const { return no_flip_capture_count_; }
+  // The game is drawn after this many plies without a flip or a capture.
+  static constexpr uint32_t GetNoFlipCaptureCountLimit() {
+    return kNoFlipCaptureCountLimit;
+  }
 
   friend std::ostream &operator<<(std::ostream &os, const ChessBoard &board);
 };
 
+static_assert(sizeof(ChessBoard) == 64, "ChessBoard must fit a cache line");
+
 class BoardUpdater {
+  // Upper bound of the number of moves made through a single updater.
+  static constexpr size_t kMaxHistory = 256;
+
   ChessBoard &board_;
-  std::vector<ChessMove> history_;
-  std::vector<ChessPiece> captured_;
-  std::vector<uint32_t> no_flip_capture_counts_;
+  FixedVector<ChessMove, kMaxHistory> history_;
+  FixedVector<ChessPiece, kMaxHistory> captured_;
+  FixedVector<uint8_t, kMaxHistory> no_flip_capture_counts_;
   bool is_initial_;
 
   void UndoMove(ChessMove mv);
 
  public:
   explicit BoardUpdater(ChessBoard &b);
-  void SaveMove(ChessMove v) { history_.push_back(std::move(v)); }
+  void SaveMove(ChessMove v) { history_.push_back(v); }
   void SaveCaptured(ChessPiece c) { captured_.push_back(c); }
 
-  void SaveNoFlipCaptureCount(uint32_t c) {
+  void SaveNoFlipCaptureCount(uint8_t c) {
     no_flip_capture_counts_.push_back(c);
   }
 
   void SetIsInitial(bool v) { is_initial_ = v; }
-  void MakeMove(const ChessMove &mv);
+  ChessBoard &GetBoard() { return board_; }
+  // The number of moves made through this updater that are not rewound yet.
+  size_t GetPly() const { return history_.size(); }
+  void MakeMove(ChessMove mv);
+  void MakeNullMove() { board_.MakeNullMove(this); }
   void Rewind();
 };
 
+// The copy-make counterpart of BoardUpdater: every move is made on a copy of
+// the board pushed on a preallocated stack, so rewinding is a pop.
+class BoardStack {
+  static constexpr size_t kMaxHistory = 256;
+
+  std::array<ChessBoard, kMaxHistory + 1> boards_;
+  size_t ply_;
+
+ public:
+  BoardStack() : ply_(0) {}
+  ChessBoard &GetBoard() { return boards_[ply_]; }
+  size_t GetPly() const { return ply_; }
+
+  void MakeMove(ChessMove mv) {
+    assert(ply_ < kMaxHistory);
+    boards_[ply_ + 1] = boards_[ply_];
+    boards_[++ply_].MakeMove(mv);
+  }
+  void MakeNullMove() {
+    assert(ply_ < kMaxHistory);
+    boards_[ply_ + 1] = boards_[ply_];
+    boards_[++ply_].MakeNullMove();
+  }
+
+  void Rewind() {
+    assert(ply_ > 0);
+    --ply_;
+  }
+};
+
 #endif  // CHESS_H_
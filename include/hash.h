@@ -1,10 +1,17 @@
 #ifndef HASH_H_
 #define HASH_H_
 
-#include <algorithm>
+#include <sys/mman.h>
+
 #include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <random>
+#include <limits>
+#include <memory>
+#include <new>
 
 using uint128_t = unsigned __int128;
 
@@ -20,58 +27,217 @@ inline std::ostream &operator<<(std::ostream &os, uint128_t v) {
   return os;
 }
 
-template <size_t N, size_t M, size_t K>
-class ZobristHash {
-  std::array<std::array<uint128_t, M>, N> hash_pieces_;
-  std::array<uint128_t, K> hash_player_;
+#ifdef ZOBRIST_64
+using HashKey = uint64_t;
+#else
+using HashKey = uint128_t;
+#endif
 
- public:
-  explicit ZobristHash(uint64_t seed = 0) {
-    std::mt19937 rng(seed);
-    std::uniform_int_distribution<uint64_t> dist;
+// SplitMix64, usable in constant expressions.
+constexpr uint64_t SplitMix64(uint64_t &state) {
+  uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
 
-    auto Rand128 = [&rng, &dist]() -> uint128_t {
-      return (uint128_t(dist(rng)) << 64) | uint128_t(dist(rng));
-    };
+template <size_t N, size_t M>
+using ZobristTable = std::array<std::array<HashKey, M>, N>;
 
-    for (size_t i = 0; i < N; ++i) {
-      std::generate(hash_pieces_[i].begin(), hash_pieces_[i].end(), Rand128);
+// Generates N x M random keys at compile time, so that the tables are shared
+// by every board instead of being seeded per instance.
+template <size_t N, size_t M>
+constexpr ZobristTable<N, M> BuildZobristTable(uint64_t seed) {
+  ZobristTable<N, M> table{};
+  uint64_t state = seed;
+  for (size_t i = 0; i < N; ++i) {
+    for (size_t j = 0; j < M; ++j) {
+      table[i][j] = SplitMix64(state);
+#ifndef ZOBRIST_64
+      table[i][j] = (table[i][j] << 64) | SplitMix64(state);
+#endif
     }
-    for (size_t i = 0; i < K; ++i) hash_player_[i] = Rand128();
   }
+  return table;
+}
 
-  uint128_t GetPieceHash(size_t i, size_t j) const {
-    return hash_pieces_[i][j];
-  };
-
-  uint128_t GetPlayerHash(size_t idx) const { return hash_player_[idx]; }
-};
 enum Status : uint8_t { NO_VALUE, EXACT_VALUE, LOWER_BOUND, UPPER_BOUND };
 
+// A transposition table entry. The key holds the hash bits that are not used
+// for indexing; the bound and the search generation share a byte.
 template <class MoveT>
 struct Entry {
-  Status flag;
-  uint128_t hash_value;
+  uint64_t key;
   float score;
-  int depth;
   MoveT best_move;
+  uint8_t depth;
+  uint8_t flag_generation;
+
+  static_assert(sizeof(MoveT) == 2, "moves are expected to be packed");
 
-  Entry() = default;
-  Entry(Status f, uint128_t v, float s, int d, const MoveT &mv)
-      : flag(f), hash_value(v), score(s), depth(d), best_move(mv) {}
+  Status GetFlag() const { return Status(flag_generation & 3); }
+  uint8_t GetGeneration() const { return flag_generation >> 2; }
 };
 
-template <size_t B, class MoveT>
+// A table of 64-byte buckets, each holding four entries. Replacement prefers
+// empty entries, then the one with the lowest depth once its age is counted.
+//
+// The table is shared by the search threads without locks: every slot stores
+// the key XOR-ed with the packed payload, so an entry torn by concurrent
+// writers fails the key check and reads as a miss.
+template <class MoveT>
 class TranspositionTable {
-  static constexpr size_t N = (1 << B);
-  std::array<Entry<MoveT>, N> table_;
+  static constexpr size_t kBucketSize = 4;
+  static constexpr size_t kHugePageSize = 2 << 20;
+
+  struct Slot {
+    std::atomic<uint64_t> check;
+    std::atomic<uint64_t> data;
+  };
+
+  struct alignas(64) Bucket {
+    std::array<Slot, kBucketSize> slots;
+  };
+  static_assert(sizeof(Bucket) == 64, "a bucket should fill a cache line");
+
+  struct FreeDeleter {
+    void operator()(Bucket *p) const { std::free(p); }
+  };
+
+  std::unique_ptr<Bucket[], FreeDeleter> buckets_;
+  size_t mask_;
+  uint8_t generation_;
+
+  static uint64_t GetKey(HashKey v) {
+#ifdef ZOBRIST_64
+    return v;
+#else
+    return static_cast<uint64_t>(v >> 64);
+#endif
+  }
+
+  static uint64_t Pack(const Entry<MoveT> &e) {
+    uint32_t score;
+    uint16_t move;
+    std::memcpy(&score, &e.score, sizeof(score));
+    std::memcpy(&move, &e.best_move, sizeof(move));
+    return uint64_t(score) | uint64_t(move) << 32 | uint64_t(e.depth) << 48 |
+           uint64_t(e.flag_generation) << 56;
+  }
+
+  static Entry<MoveT> Unpack(uint64_t check, uint64_t data) {
+    Entry<MoveT> e;
+    uint32_t score = static_cast<uint32_t>(data);
+    uint16_t move = static_cast<uint16_t>(data >> 32);
+    e.key = check ^ data;
+    std::memcpy(&e.score, &score, sizeof(score));
+    std::memcpy(static_cast<void *>(&e.best_move), &move, sizeof(move));
+    e.depth = static_cast<uint8_t>(data >> 48);
+    e.flag_generation = static_cast<uint8_t>(data >> 56);
+    return e;
+  }
+
+  static Entry<MoveT> Load(const Slot &slot) {
+    return Unpack(slot.check.load(std::memory_order_relaxed),
+                  slot.data.load(std::memory_order_relaxed));
+  }
+
+  Bucket &GetBucket(HashKey v) const {
+    return buckets_[static_cast<size_t>(v) & mask_];
+  }
 
  public:
-  explicit TranspositionTable() {
-    for (size_t i = 0; i < N; ++i) table_[i].flag = NO_VALUE;
+  static constexpr size_t kDefaultSizeMB = 64;
+
+  explicit TranspositionTable(size_t size_mb = kDefaultSizeMB)
+      : mask_(0), generation_(0) {
+    Resize(size_mb);
+  }
+
+  // Reallocates the table with the largest power-of-two number of buckets
+  // that fits in size_mb megabytes. The contents are cleared.
+  void Resize(size_t size_mb) {
+    size_t num_buckets = 1;
+    while (num_buckets * 2 * sizeof(Bucket) <= (size_mb << 20))
+      num_buckets *= 2;
+    const size_t bytes = num_buckets * sizeof(Bucket);
+    const size_t alignment = bytes >= kHugePageSize ? kHugePageSize : 64;
+    void *p = std::aligned_alloc(alignment, bytes);
+    if (p == nullptr) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+    if (alignment == kHugePageSize) madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+    buckets_.reset(new (p) Bucket[num_buckets]);
+    mask_ = num_buckets - 1;
+    Clear();
+  }
+
+  void Clear() {
+    for (size_t i = 0; i <= mask_; ++i) {
+      for (auto &slot : buckets_[i].slots) {
+        slot.check.store(0, std::memory_order_relaxed);
+        slot.data.store(0, std::memory_order_relaxed);
+      }
+    }
+    generation_ = 0;
+  }
+
+  size_t GetSizeMB() const { return ((mask_ + 1) * sizeof(Bucket)) >> 20; }
+
+  // Starts a new search so that entries of earlier searches age out.
+  void NewSearch() { generation_ = (generation_ + 1) & 63; }
+
+  void Prefetch(HashKey v) const { __builtin_prefetch(&GetBucket(v)); }
+
+  // Copies the entry of v to *entry and returns whether it was found.
+  bool Probe(HashKey v, Entry<MoveT> *entry) const {
+    const uint64_t key = GetKey(v);
+    for (const auto &slot : GetBucket(v).slots) {
+      Entry<MoveT> e = Load(slot);
+      if (e.GetFlag() != NO_VALUE && e.key == key) {
+        *entry = e;
+        return true;
+      }
+    }
+    return false;
   }
 
-  Entry<MoveT> &GetEntry(uint128_t v) { return table_[v & (N - 1)]; }
+  void Store(HashKey v, Status flag, float score, int depth,
+             const MoveT &mv) {
+    const uint64_t key = GetKey(v);
+    auto &slots = GetBucket(v).slots;
+    Slot *victim = &slots[0];
+    Entry<MoveT> old = Load(slots[0]);
+    int victim_value = std::numeric_limits<int>::max();
+    for (auto &slot : slots) {
+      Entry<MoveT> e = Load(slot);
+      if (e.GetFlag() == NO_VALUE || e.key == key) {
+        victim = &slot;
+        old = e;
+        break;
+      }
+      int age = (generation_ - e.GetGeneration()) & 63;
+      int value = e.depth - 8 * age;
+      if (value < victim_value) {
+        victim = &slot;
+        old = e;
+        victim_value = value;
+      }
+    }
+    Entry<MoveT> e;
+    e.key = key;
+    e.score = score;
+    // Keep the move of an earlier search of the same position if there is no
+    // better one.
+    e.best_move = (old.key == key && old.GetFlag() != NO_VALUE && mv == MoveT())
+                      ? old.best_move
+                      : mv;
+    e.depth = static_cast<uint8_t>(depth);
+    e.flag_generation = static_cast<uint8_t>(flag | generation_ << 2);
+    const uint64_t data = Pack(e);
+    victim->check.store(key ^ data, std::memory_order_relaxed);
+    victim->data.store(data, std::memory_order_relaxed);
+  }
 };
 
 #endif  // HASH_H_
@@ -0,0 +1,136 @@
+#ifndef MCTS_H_
+#define MCTS_H_
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "chess.h"
+#include "nnue.h"
+#include "playout.h"
+#include "time_manager.h"
+
+// A pool of objects handed out in contiguous blocks by an atomic bump pointer
+// and released all at once, so that threads growing a tree never contend on
+// the heap. The objects are not constructed by Allocate; callers initialize
+// every field they hand out.
+template <class T>
+class Arena {
+  std::unique_ptr<T[]> items_;
+  size_t capacity_;
+  std::atomic<size_t> used_;
+
+ public:
+  explicit Arena(size_t capacity = 0) : capacity_(0), used_(0) {
+    Resize(capacity);
+  }
+
+  void Resize(size_t capacity) {
+    // Pages are only committed once handed out.
+    items_.reset(capacity > 0 ? new T[capacity] : nullptr);
+    capacity_ = capacity;
+    used_.store(0);
+  }
+  void Clear() { used_.store(0); }
+
+  // Returns n consecutive objects, or nullptr once the arena is exhausted.
+  T *Allocate(size_t n) {
+    const size_t begin = used_.fetch_add(n, std::memory_order_relaxed);
+    return begin + n <= capacity_ ? &items_[begin] : nullptr;
+  }
+
+  size_t GetUsed() const {
+    return std::min(used_.load(std::memory_order_relaxed), capacity_);
+  }
+  size_t GetCapacity() const { return capacity_; }
+};
+
+// Monte Carlo tree search with UCT, an alternative to the NegaScout searcher
+// for positions with many covered pieces, where the expectimax tree is too
+// wide to search deep.
+//
+// A flip is a chance node whose children are its outcomes, one per kind of
+// covered piece, visited in proportion to the number of covered pieces of
+// that kind. Leaves are scored by the evaluation (ChessBoard::Evaluate or the
+// network) squashed into a winning probability, or by a random playout to the
+// end of the game. The threads of a search share one tree: a node counts its
+// visit on the way down and its reward on the way up, so that until then
+// it looks lost to the other threads (a virtual loss) and they spread over
+// other moves.
+class Mcts {
+  struct Node {
+    // The visits, counted on descent, and the sum of the rewards, in units of
+    // 1 / kRewardScale, from the view of the player who made move.
+    std::atomic<uint32_t> visits;
+    std::atomic<uint64_t> rewards;
+    // Published by the release store of state.
+    Node *children;
+    uint16_t num_children;
+    // The move into this node. The outcomes of a flip have the revealed piece
+    // as result, while the chance node itself has COVERED_PIECE.
+    ChessMove move;
+    // The number of covered pieces of the kind an outcome reveals.
+    uint8_t weight;
+    std::atomic<uint8_t> state;
+
+    void Init(ChessMove mv, uint8_t w);
+    bool IsChance() const {
+      return move.IsFlip() && move.GetResult() == COVERED_PIECE;
+    }
+    float GetValue() const;
+  };
+
+  enum NodeState : uint8_t { kUnexpanded, kExpanding, kExpanded };
+
+  Arena<Node> arena_;
+  const std::atomic<bool> &stop_;
+  // Raised by the main thread of a search once its budget is spent.
+  std::atomic<bool> done_;
+  std::atomic<uint64_t> num_iterations_;
+  Node root_;
+  bool playouts_;
+  // Scores leaves in place of ChessBoard::Evaluate when loaded.
+  const Network *network_;
+
+  static constexpr uint64_t kRewardScale = 1 << 16;
+  // The exploration constant of UCT for rewards in [0, 1].
+  static constexpr float kExploration = 0.7;
+  // The score of Evaluate that is worth a winning probability of about 73%.
+  static constexpr float kEvalScale = 200;
+  static constexpr size_t kMaxPath = 256;
+  // The main thread checks the clock every kCheckInterval iterations.
+  static constexpr uint64_t kCheckInterval = 64;
+
+  // The winning probability of the player to move on a leaf.
+  float EvaluateLeaf(const ChessBoard &board, PlayoutRng *rng) const;
+  // Creates the children of node unless another thread is at it. Returns
+  // whether this call expanded it.
+  bool Expand(const ChessBoard &board, Node *node);
+  Node *SelectChild(Node *node) const;
+  Node *SelectOutcome(Node *node) const;
+  // Descends from the root to a leaf of the tree, expands it and backs up its
+  // reward.
+  void RunIteration(const ChessBoard &root_board, PlayoutRng *rng);
+  void Work(const ChessBoard &board, size_t id);
+
+ public:
+  static constexpr size_t kDefaultSizeMB = 64;
+
+  explicit Mcts(const std::atomic<bool> &stop,
+                size_t size_mb = kDefaultSizeMB);
+  Mcts(const Mcts &) = delete;
+  Mcts &operator=(const Mcts &) = delete;
+
+  void Resize(size_t size_mb);
+  // Scores leaves by random playouts instead of the evaluation.
+  void SetPlayouts(bool playouts) { playouts_ = playouts; }
+  void SetNetwork(const Network *network) { network_ = network; }
+
+  // Searches the board for the player to move on num_threads threads until
+  // the soft limit of time_manager, the stop flag or iteration_limit
+  // iterations if positive, and returns the most visited move.
+  ChessMove Search(const ChessBoard &board, size_t num_threads,
+                   const TimeManager &time_manager, uint64_t iteration_limit);
+};
+
+#endif  // MCTS_H_
@@ -0,0 +1,58 @@
+#ifndef MOVE_PICKER_H_
+#define MOVE_PICKER_H_
+
+#include <array>
+#include <cstdint>
+
+#include "chess.h"
+
+using KillerMoves = std::array<ChessMove, 2>;
+using HistoryTable = std::array<std::array<int32_t, 32>, 32>;
+
+// Hands out the moves of a position lazily in stages: the transposition table
+// move, captures by MVV-LVA, killer moves, quiet moves by the history heuristic
+// and finally flips. A stage is generated only when the previous ones are
+// exhausted without a cutoff.
+class MovePicker {
+  enum Stage : uint8_t {
+    TT_MOVE,
+    GENERATE_CAPTURES,
+    CAPTURES,
+    KILLERS,
+    GENERATE_QUIETS,
+    QUIETS,
+    FLIPS,
+    DONE
+  };
+
+  const ChessBoard &board_;
+  ChessColor color_;
+  ChessMove tt_move_;
+  const KillerMoves &killers_;
+  const HistoryTable &history_;
+  Stage stage_;
+  MoveList moves_;
+  std::array<float, kMaxMoves> scores_;
+  size_t index_;
+  uint32_t flips_;
+
+  bool IsKiller(ChessMove mv) const;
+  // Moves the best scored remaining move to the front and returns it.
+  ChessMove PickBest();
+
+ public:
+  explicit MovePicker(const ChessBoard &board, ChessColor color,
+                      ChessMove tt_move, const KillerMoves &killers,
+                      const HistoryTable &history);
+
+  // Returns the next move to search, or the null move when exhausted.
+  ChessMove Next();
+
+  // Whether the last move handed out is a quiet move ordered by history, i.e.
+  // neither the transposition table move nor a killer.
+  bool InQuietStage() const { return stage_ == QUIETS; }
+  // Whether the moves left are flips only.
+  bool InFlipStage() const { return stage_ >= FLIPS; }
+};
+
+#endif  // MOVE_PICKER_H_
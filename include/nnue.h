@@ -0,0 +1,126 @@
+#ifndef NNUE_H_
+#define NNUE_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "chess.h"
+
+// An efficiently updatable neural network (NNUE) that evaluates boards in
+// place of ChessBoard::Evaluate, memory-mapped from a network file.
+//
+// The inputs describe the board from the view of a color: one per square and
+// state of the square (a ChessPiece, empty and covered included), and one per
+// kind of covered piece and count from 1 to kMaxCovered, set while the pool
+// holds at least that many. The view of BLACK turns the board by half a turn
+// and swaps the colors, so both views share the weights of the first layer,
+// whose int16 sums are the accumulator of each view. A move changes only a
+// few inputs, so the accumulators are updated by a few vector additions
+// instead of recomputed. The accumulators of the player to move and of the
+// opponent, clipped to [0, 127], go through two layers of kLayerSize clipped
+// units and a linear output, all with int8 weights scaled by
+// 2^kWeightShift and int32 biases.
+//
+// A network file starts with kMagic, the number of inputs, kHidden and
+// kLayerSize as uint32, which must match those of the build, and the float the
+// output is multiplied by to give the score, padded to kHeaderSize bytes. The
+// parameters follow in little-endian order: the int16 biases and weights
+// (input-major) of the first layer, then for each later layer its int32 biases
+// and int8 weights (output-major).
+class Network {
+ public:
+  static constexpr size_t kNumSquareInputs = 32 * 16;
+  static constexpr size_t kMaxCovered = 5;
+  static constexpr size_t kNumInputs =
+      kNumSquareInputs + kNumChessPieces * 2 * kMaxCovered;
+  static constexpr size_t kHidden = 128;
+  static constexpr size_t kLayerSize = 32;
+  static constexpr int kWeightShift = 6;
+  static constexpr char kMagic[4] = {'C', 'D', 'N', 'N'};
+  static constexpr size_t kHeaderSize = 32;
+
+  // The sums of the first layer for the view of each color.
+  struct alignas(32) Accumulator {
+    std::array<std::array<int16_t, kHidden>, 2> values;
+  };
+
+  // The inputs a move turns off and on, for each view.
+  struct Changes {
+    std::array<FixedVector<uint16_t, 4>, 2> removed, added;
+  };
+
+  Network();
+  ~Network();
+  Network(const Network &) = delete;
+  Network &operator=(const Network &) = delete;
+
+  // Maps the network file at path, replacing the network loaded before.
+  // Returns false if the file cannot be mapped or does not match the build.
+  bool Load(const std::string &path);
+  void Unload();
+  bool IsLoaded() const { return mapping_ != nullptr; }
+
+  // The inputs that differ between the boards.
+  static void GetChanges(const ChessBoard &before, const ChessBoard &after,
+                         Changes *changes);
+  // Computes the accumulators of the board from scratch.
+  void Refresh(const ChessBoard &board, Accumulator *accumulator) const;
+  // Computes the accumulators after the changes from those before.
+  void Update(const Accumulator &before, const Changes &changes,
+              Accumulator *after) const;
+  // The score of the accumulators for color.
+  float Evaluate(const Accumulator &accumulator, ChessColor color) const;
+  // The same, computing the accumulators of the board from scratch.
+  float Evaluate(const ChessBoard &board, ChessColor color) const;
+
+ private:
+  const int16_t *input_biases_;
+  const int16_t *input_weights_;
+  const int32_t *hidden1_biases_;
+  const int8_t *hidden1_weights_;
+  const int32_t *hidden2_biases_;
+  const int8_t *hidden2_weights_;
+  const int32_t *output_bias_;
+  const int8_t *output_weights_;
+  float output_scale_;
+  void *mapping_;
+  size_t mapping_size_;
+};
+
+// The accumulators along the line of a search. A move only records the
+// inputs it changes, and Evaluate brings the accumulators up to date from the
+// last one computed, so nodes that are never evaluated cost no update.
+// Rewinding a move is a pop.
+class AccumulatorStack {
+  struct Entry {
+    Network::Accumulator accumulator;
+    // The inputs changed by the move into this entry.
+    Network::Changes changes;
+    bool computed;
+  };
+
+  static constexpr size_t kMaxPly = 256;
+
+  const Network &network_;
+  std::vector<Entry> entries_;
+  // The board at the bottom of the stack, refreshed when first needed.
+  ChessBoard root_;
+  size_t ply_;
+
+ public:
+  explicit AccumulatorStack(const Network &network);
+
+  void Reset(const ChessBoard &board);
+  void Push(const ChessBoard &before, const ChessBoard &after);
+  void Pop() {
+    assert(ply_ > 0);
+    --ply_;
+  }
+  // The score of the board on top of the stack for color.
+  float Evaluate(ChessColor color);
+};
+
+#endif  // NNUE_H_
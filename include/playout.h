@@ -0,0 +1,63 @@
+#ifndef PLAYOUT_H_
+#define PLAYOUT_H_
+
+#include <array>
+#include <cstdint>
+
+#include "chess.h"
+
+// A splitmix64 generator: a few multiplications per number, any seed works.
+class PlayoutRng {
+  uint64_t state_;
+
+ public:
+  explicit PlayoutRng(uint64_t seed) : state_(seed) {}
+
+  uint64_t Next() {
+    uint64_t z = (state_ += 0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    return z ^ (z >> 31);
+  }
+  // A number in [0, n), by multiplication instead of division.
+  uint32_t Below(uint32_t n) {
+    return static_cast<uint32_t>((Next() >> 32) * n >> 32);
+  }
+};
+
+// A stripped-down copy of a ChessBoard that plays random games to the end as
+// fast as possible: no hash, no evaluation and no undo. Every legal move and
+// flip of the player to move is equally likely. Moves are drawn from the
+// target masks of the pieces without building a move list, and the outcome of
+// a flip from the pool of covered pieces.
+class PlayoutBoard {
+  std::array<ChessPiece, 32> squares_;
+  // The squares of the uncovered pieces of each kind and of each color.
+  std::array<uint32_t, kNumChessPieces * 2> pieces_;
+  std::array<uint32_t, 2> uncovered_;
+  uint32_t covered_squares_;
+  // The number of covered pieces of each kind and of each color.
+  std::array<uint8_t, kNumChessPieces * 2> covered_;
+  std::array<uint8_t, 2> num_covered_;
+  uint8_t no_flip_capture_count_;
+  ChessColor player_;
+  // The plies played since the copy.
+  uint32_t ply_;
+
+  void MakeFlip(uint8_t pos, PlayoutRng *rng);
+  void MakeMove(uint8_t src, uint8_t dst);
+  // Makes a random move of the player to move. Returns false if there is none.
+  bool MakeRandomMove(PlayoutRng *rng);
+
+ public:
+  explicit PlayoutBoard(const ChessBoard &board);
+
+  // Plays random moves until the game ends as ChessBoard::Terminate decides,
+  // or until a player can neither move nor flip and loses. Returns the
+  // winner, or DRAW.
+  ChessColor Playout(PlayoutRng *rng);
+
+  uint32_t GetPly() const { return ply_; }
+};
+
+#endif  // PLAYOUT_H_
@@ -0,0 +1,128 @@
+#ifndef POSITIONS_H_
+#define POSITIONS_H_
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chess.h"
+
+// A position of a game labelled with the winner of the game, the data tune
+// fits the evaluation to.
+//
+// In text a position takes one line: the rows of the board from the top as
+// in debug.cpp, the numbers of covered pieces of each kind, the player to
+// move, the no-flip/capture counter and the winner (RED, BLACK or DRAW), all
+// separated by spaces.
+struct LabeledPosition {
+  ChessBoard board;
+  ChessColor winner;
+};
+
+std::ostream &operator<<(std::ostream &os, const LabeledPosition &position);
+// Reads a position in the text format. Returns false at the end of the input
+// or on a malformed position, such as covered pieces no game can have.
+bool ReadPosition(std::istream &is, LabeledPosition *position);
+
+// A position in the binary format: the squares and the numbers of covered
+// pieces packed in nibbles as in ChessBoard, a byte each for the player to
+// move, the no-flip/capture counter and the winner, and the score of a search
+// for the player to move, kNoScore if there is none.
+struct PositionRecord {
+  static constexpr float kNoScore = std::numeric_limits<float>::quiet_NaN();
+
+  std::array<uint8_t, 16> squares;
+  std::array<uint8_t, 7> covered;
+  ChessColor player;
+  uint8_t no_flip_capture_count;
+  ChessColor winner;
+  std::array<uint8_t, 2> padding;
+  float score;
+
+  PositionRecord() = default;
+  explicit PositionRecord(const LabeledPosition &position,
+                          float score = kNoScore);
+
+  bool HasScore() const { return !std::isnan(score); }
+  // Unpacks the position. Returns false if the record is malformed, as
+  // ReadPosition does for text.
+  bool GetPosition(LabeledPosition *position) const;
+};
+
+static_assert(sizeof(PositionRecord) == 32,
+              "position records are expected to be packed");
+
+// Appends position records to a file.
+//
+// A position file starts with kMagic and the size of a record, padded to
+// kHeaderSize bytes, followed by the records in little-endian order. There is
+// no count, so that games can be appended to a file as they end.
+class PositionWriter {
+  std::ofstream out_;
+
+ public:
+  static constexpr char kMagic[4] = {'C', 'D', 'P', 'R'};
+  static constexpr size_t kHeaderSize = 16;
+
+  // Opens the file at path for appending, writing the header if it is empty
+  // or new. Returns false if it cannot be opened or is not a position file.
+  bool Open(const std::string &path);
+  bool IsOpen() const { return out_.is_open(); }
+
+  void Write(const PositionRecord &record) {
+    out_.write(reinterpret_cast<const char *>(&record), sizeof(record));
+  }
+  // Flushes the records written so far. Returns false on failure.
+  bool Flush() { return static_cast<bool>(out_.flush()); }
+};
+
+// The records of a position file, memory-mapped from disk so that tools
+// stream them without parsing or copying.
+class PositionFile {
+  const PositionRecord *records_;
+  size_t num_records_;
+  void *mapping_;
+  size_t mapping_size_;
+
+ public:
+  PositionFile();
+  ~PositionFile();
+  PositionFile(const PositionFile &) = delete;
+  PositionFile &operator=(const PositionFile &) = delete;
+
+  // Maps the position file at path, replacing the file loaded before.
+  // Returns false if the file cannot be mapped or is not a position file.
+  bool Load(const std::string &path);
+  void Unload();
+
+  size_t GetSize() const { return num_records_; }
+  const PositionRecord &operator[](size_t i) const { return records_[i]; }
+  const PositionRecord *begin() const { return records_; }
+  const PositionRecord *end() const { return records_ + num_records_; }
+
+  // Calls f(thread, begin, end) on num_threads threads, thread taking the
+  // records [begin, end), a contiguous share of the file.
+  template <class F>
+  void ParallelFor(size_t num_threads, F f) const {
+    num_threads = std::max<size_t>(num_threads, 1);
+    auto run = [&](size_t thread) {
+      f(thread, num_records_ * thread / num_threads,
+        num_records_ * (thread + 1) / num_threads);
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; ++i) threads.emplace_back(run, i);
+    run(0);
+    for (auto &thread : threads) thread.join();
+  }
+};
+
+#endif  // POSITIONS_H_
@@ -0,0 +1,247 @@
+#ifndef SEARCHER_H_
+#define SEARCHER_H_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "chess.h"
+#include "hash.h"
+#include "move_picker.h"
+#include "nnue.h"
+#include "tablebase.h"
+#include "task_pool.h"
+
+// Counters of the search of a single searcher, so that counting never
+// contends between threads. They are only updated when built with
+// SEARCH_STATS.
+struct SearchStats {
+  // The max/min nodes, leaves included, and the chance nodes.
+  uint64_t nodes = 0;
+  uint64_t chance_nodes = 0;
+  uint64_t tt_probes = 0;
+  uint64_t tt_hits = 0;
+  // The probes whose entry decided the node.
+  uint64_t tt_cutoffs = 0;
+  uint64_t beta_cutoffs = 0;
+  // The beta cutoffs caused by the first move searched.
+  uint64_t first_move_cutoffs = 0;
+  // Null-window searches that failed high and were searched again.
+  uint64_t scout_researches = 0;
+  // The nodes of the quiescence search, and the captures it skipped by delta
+  // pruning or by a losing static exchange.
+  uint64_t quiescence_nodes = 0;
+  uint64_t delta_prunes = 0;
+  uint64_t see_prunes = 0;
+  // Aspiration windows of SearchSingleDepth that failed.
+  uint64_t aspiration_researches = 0;
+  // The nodes scored as draws by repetition.
+  uint64_t repetitions = 0;
+  // The nodes cut by a null move, the late moves searched at a reduced depth
+  // and the quiet moves pruned as futile.
+  uint64_t null_move_cutoffs = 0;
+  uint64_t reductions = 0;
+  uint64_t futility_prunes = 0;
+
+  SearchStats &operator+=(const SearchStats &other);
+};
+
+// The selective search of NegaScout, each part switchable for A/B testing.
+// None of them applies at the root, next to the no-flip/capture draw or when
+// a win is in sight, and flips are never reduced or pruned. They are off until
+// self-play shows a gain.
+struct SearchFeatures {
+  // Late move reductions: quiet moves ordered after the killers are searched
+  // a ply shallower first.
+  bool lmr = false;
+  // Null-move pruning when the player to move has no piece en prise.
+  bool null_move = false;
+  // Futility pruning of quiet moves at frontier nodes.
+  bool futility = false;
+  // Resolving captures past the horizon instead of evaluating right away.
+  bool quiescence = true;
+};
+
+// The state of a single search thread: its own copy of the board together with
+// the move ordering heuristics. Searchers of the same agent share the
+// transposition table, the endgame tablebases and the stop flag.
+class Searcher {
+  // Moves are either made and undone on a single board, or made on copies of
+  // the board kept on a stack (COPY_MAKE).
+#ifdef COPY_MAKE
+  BoardStack updater_;
+#else
+  ChessBoard board_;
+  BoardUpdater updater_{board_};
+#endif
+  TranspositionTable<ChessMove> &table_;
+  const Tablebase &tablebase_;
+  const std::atomic<bool> &stop_;
+  ChessColor color_;
+  ChessMove best_move_;
+  std::chrono::time_point<std::chrono::steady_clock> search_start_;
+  // Set once the stop flag interrupted the current search.
+  bool search_cut_;
+
+  int completed_depth_;
+  float completed_score_;
+  ChessMove completed_move_;
+
+  SearchStats stats_;
+  // The nodes searched since NewSearch, only counted under a node limit.
+  uint64_t num_nodes_;
+  uint64_t node_limit_;
+
+  void Count(uint64_t SearchStats::*counter, uint64_t n = 1) {
+    if constexpr (kCollectStats) stats_.*counter += n;
+  }
+
+  static constexpr size_t kMaxPly = 64;
+  std::array<KillerMoves, kMaxPly> killers_;
+  HistoryTable history_;
+
+  // The position keys of the game since its last flip or capture, followed
+  // by those of the current line of the search: the node at ply p is at
+  // game_plies_ + p. A key is written whenever NegaScout enters its node, so
+  // the array always holds the current line.
+  static constexpr size_t kMaxKeys = 320;
+  std::array<HashKey, kMaxKeys> keys_;
+  size_t game_plies_;
+
+  // Records the position of the node at ply and returns whether it repeats
+  // an earlier one since the last flip or capture.
+  bool IsRepetition(size_t ply);
+
+  // The network that evaluates the leaves in place of ChessBoard::Evaluate
+  // if one is loaded when the search starts, and its accumulators along the
+  // current line.
+  const Network *network_;
+  std::unique_ptr<AccumulatorStack> accumulators_;
+  bool use_network_;
+
+  // Make and undo moves on the board, keeping the accumulators in step.
+  void MakeMove(ChessMove mv);
+  void MakeNullMove();
+  void Rewind();
+  // The evaluation of the current board for color.
+  float Evaluate(ChessColor color);
+
+  SearchFeatures features_;
+  // The ply right after the innermost null move on the current line, so that
+  // two null moves never follow each other.
+  size_t null_move_ply_;
+  static constexpr size_t kNoNullMove = ~size_t(0);
+  static constexpr int kNullMoveMinDepth = 3;
+  static constexpr int kNullMoveReduction = 2;
+  static constexpr int kLmrMinDepth = 3;
+  // The moves searched at full depth before the reductions start.
+  static constexpr size_t kLmrMinMoves = 3;
+  // The plies of captures the quiescence search goes through at most.
+  static constexpr int kMaxQuiescencePly = 16;
+  // The positional swing a capture may add to the value of its victim.
+  static constexpr float kDeltaMargin = 50;
+  // The gain a quiet move at remaining depth d is assumed to fall short of.
+  static constexpr std::array<float, 3> kFutilityMargins = {0, 30, 120};
+
+  // Chance nodes with at least this remaining depth expand their outcomes in
+  // parallel when a task pool is attached.
+  static constexpr int kParallelDepth = 3;
+  static constexpr size_t kMaxFlips = 32;
+  TaskPool *pool_;
+  size_t queue_;
+  const std::vector<std::unique_ptr<Searcher>> *workers_;
+
+  friend class ChanceJob;
+
+  // Searches the child reached by playing mv on the board, as a task taken
+  // over from another searcher. Sets *cut if the search was cut.
+  float SearchChild(const ChessBoard &board, ChessMove mv, float alpha,
+                    float beta, int depth, ChessColor color, bool *cut);
+
+  // Computes the expected score of each flip, sharing the outcomes of all the
+  // flips with idle pool workers. The sum over outcomes is taken in a fixed
+  // order, so the result does not depend on which thread searched what.
+  // lower and upper, if not null, bound the score of each outcome, in the
+  // order of the flips and of the kinds of covered pieces.
+  void ParallelChanceSearch(float alpha, float beta, int depth,
+                            ChessColor color,
+                            const FixedVector<ChessMove, kMaxFlips> &flips,
+                            const float *lower, const float *upper,
+                            float *values);
+
+  // Searches the captures, flips excluded, until the position is quiet. The
+  // player may stand pat on the evaluation instead of capturing.
+  float Quiescence(float alpha, float beta, ChessColor color, int qply);
+
+  // Records the quiet move that caused a beta cutoff at the given ply.
+  void UpdateQuietStats(ChessMove mv, size_t ply, int depth);
+
+  // Expectimax over the outcomes of flipping pos, pruned with Star1 and
+  // Star2.
+  float ChanceNodeSearch(float alpha, float beta, int depth, ChessColor color,
+                         uint8_t pos);
+
+  static constexpr size_t kMaxOutcomes = kNumChessPieces * 2;
+
+  // Narrows [lower[k], upper[k]], the bounds of the score after flipping
+  // outcomes[k] at pos, with the transposition table entries of the children.
+  void ProbeOutcomes(uint8_t pos, int depth,
+                     const FixedVector<ChessPiece, kMaxOutcomes> &outcomes,
+                     float *lower, float *upper);
+
+ public:
+#ifdef SEARCH_STATS
+  static constexpr bool kCollectStats = true;
+#else
+  static constexpr bool kCollectStats = false;
+#endif
+  static constexpr float kInf = 1E9;
+  // A win at remaining depth d scores kWinScore * (d + 1).
+  static constexpr float kWinScore = 10000;
+
+  explicit Searcher(TranspositionTable<ChessMove> &table,
+                    const Tablebase &tablebase, const std::atomic<bool> &stop);
+
+  // Attaches the task pool used to parallelize chance nodes. queue is the
+  // pool queue owned by this searcher and workers the searchers of the pool
+  // workers. A null pool makes chance nodes serial.
+  void SetTaskPool(TaskPool *pool, size_t queue,
+                   const std::vector<std::unique_ptr<Searcher>> *workers);
+
+  // Prepares a search of the board for the color. history holds the keys
+  // (GetPositionKey) of the positions of the game since its last flip or
+  // capture, the board excluded, to detect repetitions. The search runs until
+  // it completes or the stop flag is raised, which is checked at every node.
+  void NewSearch(const ChessBoard &board, ChessColor color,
+                 const std::vector<HashKey> &history = {});
+
+  float NegaScout(float alpha, float beta, int depth, ChessColor color,
+                  bool save_move);
+
+  // Returns the score and the elapsed milliseconds.
+  std::pair<float, int> SearchSingleDepth(float alpha, float beta, int depth);
+
+  ChessMove GetBestMove() const { return best_move_; }
+  // The board at the current node of the search.
+  ChessBoard &GetBoard() { return updater_.GetBoard(); }
+
+  // The result of the deepest search that was not cut.
+  int GetCompletedDepth() const { return completed_depth_; }
+  float GetCompletedScore() const { return completed_score_; }
+  ChessMove GetCompletedMove() const { return completed_move_; }
+
+  void SetFeatures(const SearchFeatures &features) { features_ = features; }
+  // Evaluates with the network, from the next search on, whenever it is
+  // loaded. The network must outlive the searcher.
+  void SetNetwork(const Network *network);
+
+  // Cuts the search once it searched this many nodes, if positive.
+  void SetNodeLimit(uint64_t nodes) { node_limit_ = nodes; }
+
+  // The counters since NewSearch.
+  const SearchStats &GetStats() const { return stats_; }
+};
+
+#endif  // SEARCHER_H_
@@ -0,0 +1,79 @@
+#ifndef TABLEBASE_H_
+#define TABLEBASE_H_
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "chess.h"
+
+// Endgame tablebases of the fully revealed positions with few pieces, solved
+// by retrograde analysis (see tbgen.cpp) and memory-mapped from disk.
+//
+// A table covers one material signature and holds a byte per position and
+// player to move: kDraw, or the number of plies to the end of the game under
+// perfect play, which is odd for a win and even for a loss of the player to
+// move. The no-flip/capture rule is ignored, so a result is only reachable if
+// its distance does not exceed the plies left before that rule applies.
+class Tablebase {
+  std::unordered_map<uint64_t, const uint8_t *> tables_;
+  std::vector<std::pair<void *, size_t>> mappings_;
+  size_t max_pieces_;
+
+ public:
+  static constexpr size_t kMaxPieces = 4;
+  static constexpr uint8_t kDraw = 0xFF;
+
+  // The pieces of a position, red first, each color by decreasing kind.
+  using Material = FixedVector<ChessPiece, kMaxPieces>;
+  using Squares = std::array<uint8_t, kMaxPieces>;
+
+  // A table file starts with kMagic, the number of pieces and the pieces,
+  // padded to kHeaderSize bytes.
+  static constexpr char kMagic[4] = {'C', 'D', 'T', 'B'};
+  static constexpr size_t kHeaderSize = 16;
+
+  // The number of entries of a table over num_pieces pieces: the player to
+  // move, then the square of each piece.
+  static constexpr size_t GetTableSize(size_t num_pieces) {
+    return size_t(2) << (5 * num_pieces);
+  }
+
+  // Tables are stored with the colors swapped when black has more pieces or,
+  // with as many pieces, stronger ones.
+  static bool IsCanonical(const Material &material);
+  static uint64_t GetKey(const Material &material);
+  // The file name of the table, e.g. "KPk.tb".
+  static std::string GetFileName(const Material &material);
+
+  // Returns the index of the position where material[i] stands on
+  // squares[i]. Identical pieces may be given in any order.
+  static size_t GetIndex(const Material &material, Squares squares,
+                         ChessColor player);
+  // Sets *material and *index to the canonical material of the board and the
+  // index of the position in its table. Returns false if the board is not
+  // fully revealed or has more than kMaxPieces pieces.
+  static bool GetIndex(const ChessBoard &board, ChessColor player,
+                       Material *material, size_t *index);
+
+  Tablebase();
+  ~Tablebase();
+  Tablebase(const Tablebase &) = delete;
+  Tablebase &operator=(const Tablebase &) = delete;
+
+  // Maps every table file of dir and returns the number of tables mapped.
+  size_t Load(const std::string &dir);
+  // Registers a table held by the caller, which must outlive this object.
+  void Add(const Material &material, const uint8_t *data);
+
+  // Sets *value to the entry of the board with the player to move. Returns
+  // false if no table covers the board.
+  bool Probe(const ChessBoard &board, ChessColor player, uint8_t *value) const;
+
+  size_t GetMaxPieces() const { return max_pieces_; }
+};
+
+#endif  // TABLEBASE_H_
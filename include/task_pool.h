@@ -0,0 +1,65 @@
+#ifndef TASK_POOL_H_
+#define TASK_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A pool of worker threads that steal jobs published by busy threads. Every
+// thread that publishes jobs owns a queue: the pool workers own queues
+// [0, num_workers) and the external threads the queues after them.
+class TaskPool {
+ public:
+  // A job is a set of units of work claimed one at a time. The owner keeps
+  // claiming units itself, so a job completes even if no worker picks it up.
+  class Job {
+    friend class TaskPool;
+    std::atomic<int> users_{0};
+
+   public:
+    virtual ~Job() = default;
+    // Whether there are units left to claim.
+    virtual bool HasWork() const = 0;
+    // Claims and runs one unit on the given pool worker. Returns false when
+    // there was nothing left to claim.
+    virtual bool RunOne(size_t worker) = 0;
+  };
+
+  explicit TaskPool(size_t num_workers, size_t num_external);
+  ~TaskPool();
+
+  TaskPool(const TaskPool &) = delete;
+  TaskPool &operator=(const TaskPool &) = delete;
+
+  size_t GetNumWorkers() const { return workers_.size(); }
+
+  // Publishes the job on the queue so that idle workers can steal it.
+  void Push(size_t queue, Job *job);
+  // Withdraws the job and waits until no worker is running it any more.
+  void Remove(size_t queue, Job *job);
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Job *> jobs;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> workers_;
+  std::atomic<bool> quit_;
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_up_;
+
+  // Returns a job with work left, preferring the newest job of the worker's
+  // own queue and otherwise stealing the oldest job of another queue. The
+  // returned job is marked as used.
+  Job *Acquire(size_t worker);
+  void WorkerLoop(size_t worker);
+};
+
+#endif  // TASK_POOL_H_
@@ -0,0 +1,83 @@
+#ifndef TIME_MANAGER_H_
+#define TIME_MANAGER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "chess.h"
+
+// Budgets the time of a move and stops the search on time.
+//
+// The soft limit is the time the move is expected to take: the iterative
+// deepening loop asks ShouldDeepen after every iteration, which predicts the
+// duration of the next iteration from the growth of the previous ones. The
+// hard limit is enforced by a timer thread that raises the stop flag of the
+// searchers, so a search never runs past it by more than a node.
+class TimeManager {
+  using Clock = std::chrono::steady_clock;
+
+  Clock::time_point start_;
+  int soft_limit_, hard_limit_;
+  // A fixed time per move overriding the budget, if positive.
+  int move_time_;
+  int last_iteration_, prev_iteration_;
+  ChessMove last_best_move_;
+  // A decaying count of the iterations that changed the best move.
+  float instability_;
+
+  std::thread timer_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool cancelled_;
+
+  // The number of our moves the rest of the game is budgeted over, when all
+  // the pieces are revealed; every covered piece adds kMovesPerCovered.
+  static constexpr int kMovesToGo = 20;
+  static constexpr float kMovesPerCovered = 0.5;
+  // The hard limit is at most kMaxRatio soft limits and kMaxShare of the
+  // clock, minus kMarginMs for the communication with the server.
+  static constexpr int kMaxRatio = 5;
+  static constexpr int kMaxShare = 4;
+  static constexpr int kMarginMs = 50;
+  // The assumed ratio between the durations of consecutive iterations, and
+  // the range the measured one is clamped to.
+  static constexpr float kDefaultBranching = 6;
+  static constexpr float kMinBranching = 4;
+  static constexpr float kMaxBranching = 20;
+
+  void RunTimer(std::atomic<bool> *stop);
+
+ public:
+  // The limits used when the clock is unknown.
+  static constexpr int kNoClockSoftLimitMs = 1'000;
+  static constexpr int kNoClockHardLimitMs = 20 * 1'000;
+
+  TimeManager();
+  ~TimeManager();
+  TimeManager(const TimeManager &) = delete;
+  TimeManager &operator=(const TimeManager &) = delete;
+
+  // Starts the clock of a move given the milliseconds left on our clock (0 if
+  // unknown) and the number of covered pieces, and arms the timer that raises
+  // *stop at the hard limit.
+  void Start(int time_left, int num_covered, std::atomic<bool> *stop);
+  // Disarms the timer.
+  void Stop();
+  // Gives every move exactly ms milliseconds from now on, or budgets the
+  // clock again if ms is not positive.
+  void SetMoveTime(int ms) { move_time_ = ms; }
+
+  // Records an iteration that took elapsed milliseconds and ended with
+  // best_move, and returns whether the next one is expected to complete
+  // within the budget. A best move that keeps changing extends the budget.
+  bool ShouldDeepen(int elapsed, ChessMove best_move);
+
+  int GetElapsed() const;
+  int GetSoftLimit() const { return soft_limit_; }
+  int GetHardLimit() const { return hard_limit_; }
+};
+
+#endif  // TIME_MANAGER_H_
@@ -2,197 +2,392 @@
 
 #include <algorithm>
 #include <cassert>
-#include <chrono>
+#include <charconv>
 #include <iostream>
+#include <sstream>
+#include <thread>
+#include <tuple>
 
 #include "chess.h"
 
-Agent::Agent() : color_(UNKNOWN), table_(), depth_limit_(3), num_flip_(0) {}
+namespace {
+
+double Ratio(uint64_t a, uint64_t b) { return b > 0 ? double(a) / b : 0; }
+
+// Parses the leading digits of s, 0 if there are none.
+uint64_t ParseUint(std::string_view s) {
+  uint64_t value = 0;
+  std::from_chars(s.data(), s.data() + s.size(), value);
+  return value;
+}
+
+}  // namespace
+
+Agent::Agent()
+    : time_limit_(0),
+      time_left_(0),
+      color_(UNKNOWN),
+      table_(),
+      depth_limit_(3),
+      num_flip_(0),
+      stop_(false),
+      ponder_(false),
+      node_limit_(0),
+      use_mcts_(false),
+      mcts_(stop_) {
+  SetNumThreads(1);
+  mcts_.SetNetwork(&network_);
+}
 Agent::Agent(const ChessBoard &board, ChessColor color)
-    : board_(board), color_(color), table_() {}
+    : time_limit_(0),
+      time_left_(0),
+      board_(board),
+      color_(color),
+      table_(),
+      depth_limit_(3),
+      num_flip_(0),
+      stop_(false),
+      ponder_(false),
+      node_limit_(0),
+      use_mcts_(false),
+      mcts_(stop_) {
+  SetNumThreads(1);
+  mcts_.SetNetwork(&network_);
+}
+
+Agent::~Agent() { StopPondering(); }
+
+bool Agent::SetOption(std::string_view name, std::string_view value) {
+  if (name == "hash") {
+    SetTableSize(ParseUint(value));
+    return true;
+  }
+  if (name == "threads") {
+    SetNumThreads(ParseUint(value));
+    return true;
+  }
+  if (name == "chance_threads") {
+    SetNumChanceThreads(ParseUint(value));
+    return true;
+  }
+  if (name == "tablebase") {
+    size_t count = LoadTablebase(std::string(value));
+    std::cerr << "Loaded " << count << " tablebase files" << std::endl;
+    return true;
+  }
+  if (name == "ponder") {
+    SetPonder(ParseUint(value) != 0);
+    return true;
+  }
+  if (name == "book") {
+    if (!LoadBook(std::string(value)))
+      std::cerr << "Cannot load opening book " << value << std::endl;
+    return true;
+  }
+  if (name == "nnue") {
+    if (!LoadNetwork(std::string(value)))
+      std::cerr << "Cannot load network " << value << std::endl;
+    return true;
+  }
+  if (name == "movetime") {
+    SetMoveTime(ParseUint(value));
+    return true;
+  }
+  if (name == "nodes") {
+    SetNodeLimit(ParseUint(value));
+    return true;
+  }
+  if (name == "lmr" || name == "null_move" || name == "futility" ||
+      name == "quiescence") {
+    SearchFeatures features = features_;
+    (name == "lmr"         ? features.lmr
+     : name == "null_move" ? features.null_move
+     : name == "futility"  ? features.futility
+                           : features.quiescence) = ParseUint(value) != 0;
+    SetSearchFeatures(features);
+    return true;
+  }
+  if (name == "engine") {
+    if (value != "negascout" && value != "mcts") return false;
+    SetMcts(value == "mcts");
+    return true;
+  }
+  if (name == "mcts_hash") {
+    SetMctsSize(ParseUint(value));
+    return true;
+  }
+  if (name == "mcts_playouts") {
+    SetMctsPlayouts(ParseUint(value) != 0);
+    return true;
+  }
+  return false;
+}
+
+void Agent::SetNumThreads(size_t num_threads) {
+  StopPondering();
+  searchers_.resize(std::max<size_t>(num_threads, 1));
+  for (auto &searcher : searchers_) {
+    if (!searcher)
+      searcher = std::make_unique<Searcher>(table_, tablebase_, stop_);
+  }
+  RebuildTaskPool(workers_.size());
+}
+
+void Agent::RebuildTaskPool(size_t num_workers) {
+  pool_.reset();
+  workers_.resize(num_workers);
+  for (auto &worker : workers_) {
+    if (!worker) worker = std::make_unique<Searcher>(table_, tablebase_, stop_);
+  }
+  if (num_workers > 0)
+    pool_ = std::make_unique<TaskPool>(num_workers, searchers_.size());
+  for (size_t i = 0; i < workers_.size(); ++i)
+    workers_[i]->SetTaskPool(pool_.get(), i, &workers_);
+  for (size_t i = 0; i < searchers_.size(); ++i)
+    searchers_[i]->SetTaskPool(pool_.get(), num_workers + i, &workers_);
+  for (auto &searcher : searchers_) searcher->SetNetwork(&network_);
+  for (auto &worker : workers_) worker->SetNetwork(&network_);
+  SetSearchFeatures(features_);
+}
+
+void Agent::SetSearchFeatures(const SearchFeatures &features) {
+  StopPondering();
+  features_ = features;
+  for (auto &searcher : searchers_) searcher->SetFeatures(features_);
+  for (auto &worker : workers_) worker->SetFeatures(features_);
+}
 
 void Agent::MakeMove(uint8_t src, uint8_t dst) {
+  StopPondering();
+  game_keys_.push_back(board_.GetPositionKey());
   board_.MakeMove(Move(src, dst));
+  if (board_.GetNoFlipCaptureCount() == 0) game_keys_.clear();
+  StartPondering();
 }
 
 void Agent::MakeFlip(uint8_t pos, ChessPiece result) {
+  StopPondering();
   if (((++num_flip_) & 7) == 0) {
     depth_limit_ = std::max(depth_limit_, 3 + (num_flip_ >> 3));
   }
   board_.MakeMove(Flip(pos, result));
+  game_keys_.clear();
+  StartPondering();
 }
 
-float Agent::ChanceNodeSearch(float alpha, float beta, int depth,
-                              ChessColor color, uint8_t pos,
-                              BoardUpdater &updater) {
-  const auto covered = board_.GetCoveredPieces();
-  float sum = 0;
-  int total = 0;
-  for (uint8_t i = 0; i < covered.size(); ++i) {
-    if (covered[i] > 0) {
-      total += covered[i];
-      updater.MakeMove(Flip(pos, ChessPiece(i)));
-      sum += covered[i] *
-             -NegaScout(-beta, -alpha, depth - 1, color ^ 1, false, updater);
-      updater.Rewind();
-    }
+void Agent::StartPondering() {
+  // The tree of MCTS starts afresh every move, so only NegaScout ponders.
+  if (!ponder_ || use_mcts_ || color_ == UNKNOWN ||
+      board_.GetCurrentPlayer() != (color_ ^ 1) || board_.Terminate()) {
+    return;
   }
-  return sum / total;
-}
-
-float Agent::NegaScout(float alpha, float beta, int depth, ChessColor color,
-                       bool save_move, BoardUpdater &updater) {
-  if (search_cut_) return -kInf;
-  if (depth == 0) return board_.Evaluate(color);
-  if (board_.Terminate()) {
-    ChessColor winner = board_.GetWinner();
-    if (winner == DRAW) return 0;
-    return (winner == color ? 10000 : -10000) * (depth + 1);
-  }
-  if (((++search_counter_) & 16777215) == 0) {
-    auto now = std::chrono::system_clock::now();
-    int elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
-                      now - search_start_)
-                      .count();
-    const int kTL = std::min(kTimeLimit, static_cast<int>(time_left_) >> 4);
-    if (elapsed > kTL) {
-      search_cut_ = true;
-      return -kInf;
-    }
+  table_.NewSearch();
+  // Pondering runs until the opponent moves, whatever the node limit of the
+  // last search.
+  for (auto &searcher : searchers_) {
+    searcher->NewSearch(board_, color_ ^ 1, game_keys_);
+    searcher->SetNodeLimit(0);
   }
-  float score = -kInf;  // fail soft
-  const uint128_t hv = board_.GetHashValue();
-  auto &entry = table_.GetEntry(hv);
-  if (entry.flag != NO_VALUE && entry.hash_value == hv &&
-      board_.Playable(entry.best_move)) {
-    if (entry.depth < depth) {
-      if (entry.flag == EXACT_VALUE) {
-        score = entry.score;
-        if (save_move) best_move_ = entry.best_move;
-      }
+  for (auto &worker : workers_) worker->NewSearch(board_, color_ ^ 1);
+  stop_.store(false);
+  for (size_t i = 0; i < searchers_.size(); ++i)
+    ponder_threads_.emplace_back(&Agent::HelperSearch, this, i);
+}
+
+void Agent::StopPondering() {
+  if (ponder_threads_.empty()) return;
+  stop_.store(true);
+  for (auto &thread : ponder_threads_) thread.join();
+  ponder_threads_.clear();
+}
+
+void Agent::HelperSearch(size_t id) {
+  Searcher &searcher = *searchers_[id];
+  // Odd helpers start one ply deeper so that the threads do not search in
+  // lockstep and fill the shared table with different depths.
+  float score = 0;
+  for (int depth_lim = 3 + (id & 1);
+       depth_lim <= kDepthLimit && !stop_.load(std::memory_order_relaxed);
+       ++depth_lim) {
+    if (depth_lim == 3 + static_cast<int>(id & 1)) {
+      score = searcher.SearchSingleDepth(-kInf, kInf, depth_lim).first;
     } else {
-      if (entry.flag == EXACT_VALUE) {
-        if (save_move) best_move_ = entry.best_move;
-        return entry.score;
-      }
-      if (entry.flag == LOWER_BOUND) {
-        if (entry.score >= beta) {
-          if (save_move) best_move_ = entry.best_move;
-          return entry.score;
-        }
-        alpha = std::max(alpha, entry.score);
-      } else {
-        if (entry.score <= alpha) {
-          if (save_move) best_move_ = entry.best_move;
-          return entry.score;
-        }
-        beta = std::min(beta, entry.score);
-      }
+      score = searcher.SearchSingleDepth(score - kRange, score + kRange,
+                                         depth_lim)
+                  .first;
     }
   }
-  ChessMove opt;
-  auto moves = board_.ListMoves(color);
+}
 
-  if (moves.empty() && board_.GetCoveredSquares() == 0) {
-    return -10000 * (depth + 1);
+ChessMove Agent::GenerateMove() {
+  StopPondering();
+  if (color_ == UNKNOWN) return Flip(0);
+  ChessMove book_move;
+  if (book_.Probe(board_, &book_move) && board_.Playable(book_move)) {
+    std::cerr << "book move = " << book_move << "\n";
+    return book_move;
   }
-
-  float upper_bound = beta;
-  for (auto &v : moves) {
-    updater.MakeMove(v);
-    float t = -NegaScout(-upper_bound, -std::max(alpha, score), depth - 1,
-                         color ^ 1, false, updater);
-    if (t > score) {  // failed-high
-      score = t;
-      opt = v;
-      if (save_move) best_move_ = v;
-      if (upper_bound != beta && depth >= 3 && t < beta)
-        score = -NegaScout(-beta, -t, depth - 1, color ^ 1, false, updater);
+  ChessMove best_move = use_mcts_ ? SearchMcts() : SearchNegaScout();
+  if (best_move.IsNull()) {
+    // Out of time before the first iteration completed: any legal move beats
+    // forfeiting.
+    MoveList moves = board_.ListMoves(color_);
+    if (!moves.empty()) {
+      best_move = moves[0];
+    } else if (board_.GetCoveredSquares() != 0) {
+      best_move = Flip(__builtin_ctz(board_.GetCoveredSquares()));
     }
-    updater.Rewind();
-    if (score >= beta) {
-      entry = Entry<ChessMove>(LOWER_BOUND, hv, score, depth, v);
-      return score;
+  }
+  return best_move;
+}
+
+ChessMove Agent::SearchMcts() {
+  stop_.store(false);
+  time_manager_.Start(time_left_ > 0 ? time_left_ : time_limit_,
+                      __builtin_popcount(board_.GetCoveredSquares()), &stop_);
+  std::cerr << "budget = " << time_manager_.GetSoftLimit() << "/"
+            << time_manager_.GetHardLimit() << " ms\n";
+  const ChessMove best_move =
+      mcts_.Search(board_, searchers_.size(), time_manager_, node_limit_);
+  time_manager_.Stop();
+  std::cerr << "elapsed = " << time_manager_.GetElapsed() << " ms\n";
+  return best_move;
+}
+
+ChessMove Agent::SearchNegaScout() {
+  table_.NewSearch();
+  for (auto &searcher : searchers_)
+    searcher->NewSearch(board_, color_, game_keys_);
+  searchers_[0]->SetNodeLimit(node_limit_);
+  for (auto &worker : workers_) worker->NewSearch(board_, color_);
+  stop_.store(false);
+  time_manager_.Start(time_left_ > 0 ? time_left_ : time_limit_,
+                      __builtin_popcount(board_.GetCoveredSquares()), &stop_);
+  std::vector<std::thread> helpers;
+  for (size_t i = 1; i < searchers_.size(); ++i)
+    helpers.emplace_back(&Agent::HelperSearch, this, i);
+
+  Searcher &searcher = *searchers_[0];
+  std::cerr << "depth limit = " << depth_limit_
+            << " budget = " << time_manager_.GetSoftLimit() << "/"
+            << time_manager_.GetHardLimit() << " ms\n";
+  // Search at least to depth_limit_, then as long as the next iteration is
+  // expected to fit in the budget, or the node limit if any. The timer cuts
+  // whatever runs over.
+  float score = 0;
+  // The depth, milliseconds and nodes of the completed iterations of the main
+  // thread.
+  std::vector<std::tuple<int, int, uint64_t>> iterations;
+  for (int depth_lim = 3; depth_lim <= kDepthLimit; ++depth_lim) {
+    if (depth_lim > depth_limit_)
+      std::cerr << "keep searching depth = " << depth_lim << "\n";
+    float alpha = depth_lim == 3 ? -kInf : score - kRange;
+    float beta = depth_lim == 3 ? kInf : score + kRange;
+    const int elapsed =
+        searcher.SearchSingleDepth(alpha, beta, depth_lim).second;
+    if (searcher.GetCompletedDepth() != depth_lim) break;
+    score = searcher.GetCompletedScore();
+    if constexpr (Searcher::kCollectStats)
+      iterations.emplace_back(depth_lim, elapsed, searcher.GetStats().nodes);
+    if (!time_manager_.ShouldDeepen(elapsed, searcher.GetBestMove()) &&
+        depth_lim >= depth_limit_ && node_limit_ == 0) {
+      break;
     }
-    upper_bound = std::max(score, alpha) + 1;
-  }
-  if (auto mask = board_.GetCoveredSquares(); mask > 0) {
-    while (mask > 0) {
-      int p = __builtin_ctz(mask & -mask);
-      float t = ChanceNodeSearch(std::max(alpha, score), beta, depth, color, p,
-                                 updater);
-      if (t > score) {
-        score = t;
-        opt = Flip(p);
-        if (save_move) best_move_ = Flip(p);
-      }
-      if (score >= beta) {
-        entry = Entry<ChessMove>(LOWER_BOUND, hv, score, depth, Flip(p));
-        return score;
-      }
-      mask ^= (1U << p);
+  }
+  stop_.store(true);
+  for (auto &helper : helpers) helper.join();
+  time_manager_.Stop();
+  std::cerr << "elapsed = " << time_manager_.GetElapsed() << " ms\n";
+
+  // Take the result of the deepest completed iteration, preferring the main
+  // thread on ties.
+  ChessMove best_move = searcher.GetBestMove();
+  int best_depth = searcher.GetCompletedDepth();
+  for (size_t i = 1; i < searchers_.size(); ++i) {
+    if (searchers_[i]->GetCompletedDepth() > best_depth &&
+        !searchers_[i]->GetCompletedMove().IsNull()) {
+      best_depth = searchers_[i]->GetCompletedDepth();
+      best_move = searchers_[i]->GetCompletedMove();
+      score = searchers_[i]->GetCompletedScore();
     }
   }
-  Status flag = (score > alpha) ? EXACT_VALUE : UPPER_BOUND;
-  entry = Entry<ChessMove>(flag, hv, score, depth, opt);
-  return score;
-}
-
-std::pair<float, int> Agent::SearchSingleDepth(float alpha, float beta,
-                                               int depth,
-                                               BoardUpdater &updater) {
-  search_cut_ = false;
-  search_counter_ = 0;
-  search_start_ = std::chrono::system_clock::now();
-  auto saved_best_move = best_move_;
-  best_move_ = Flip(255, NO_PIECE);
-  float score = NegaScout(alpha, beta, depth, color_, true, updater);
-  if (score <= alpha) {
-    best_move_ = Flip(255, NO_PIECE);
-    score = NegaScout(-kInf, score, depth, color_, true, updater);
-  } else if (score >= beta) {
-    best_move_ = Flip(255, NO_PIECE);
-    score = NegaScout(score, kInf, depth, color_, true, updater);
-  }
-  int time_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
-                         std::chrono::system_clock::now() - search_start_)
-                         .count();
-  if (search_cut_) best_move_ = saved_best_move;
-  return std::make_pair(score, time_elapsed);
+  std::cerr << "NegaScout score = " << score << " depth = " << best_depth
+            << "\n";
+  if constexpr (Searcher::kCollectStats)
+    PrintStats(score, best_depth, iterations);
+  return best_move;
 }
 
-ChessMove Agent::GenerateMove() {
-  if (color_ == UNKNOWN) return Flip(0);
-  BoardUpdater updater(board_);
-  std::cerr << "depth limit = " << depth_limit_ << "\n";
-  auto [score, last_search_elapsed] =
-      SearchSingleDepth(-kInf, kInf, 3, updater);
-  for (int depth_lim = 4; depth_lim <= depth_limit_; ++depth_lim) {
-    float alpha = score - kRange, beta = score + kRange;
-    std::tie(score, last_search_elapsed) =
-        SearchSingleDepth(alpha, beta, depth_lim, updater);
-  }
-  for (int depth_lim = depth_limit_;
-       depth_lim < kDepthLimit && last_search_elapsed <= kTimeThreshold;) {
-    depth_lim++;
-    std::cerr << "keep searching depth = " << depth_lim << "\n";
-    float alpha = score - kRange, beta = score + kRange;
-    std::tie(score, last_search_elapsed) =
-        SearchSingleDepth(alpha, beta, depth_lim, updater);
-  }
-  std::cerr << "NegaScout score = " << score << "\n";
-  return best_move_;
+void Agent::PrintStats(
+    float score, int depth,
+    const std::vector<std::tuple<int, int, uint64_t>> &iterations) const {
+  SearchStats stats;
+  for (const auto &searcher : searchers_) stats += searcher->GetStats();
+  for (const auto &worker : workers_) stats += worker->GetStats();
+  const int elapsed = time_manager_.GetElapsed();
+  std::ostringstream os;
+  os << "{\"depth\":" << depth << ",\"score\":" << score
+     << ",\"time_ms\":" << elapsed << ",\"nodes\":" << stats.nodes
+     << ",\"nps\":" << uint64_t(stats.nodes * 1000.0 / std::max(elapsed, 1))
+     << ",\"chance_nodes\":" << stats.chance_nodes
+     << ",\"tt_probes\":" << stats.tt_probes
+     << ",\"tt_hit_rate\":" << Ratio(stats.tt_hits, stats.tt_probes)
+     << ",\"tt_cutoff_rate\":" << Ratio(stats.tt_cutoffs, stats.tt_probes)
+     << ",\"beta_cutoffs\":" << stats.beta_cutoffs
+     << ",\"first_move_cutoff_rate\":"
+     << Ratio(stats.first_move_cutoffs, stats.beta_cutoffs)
+     << ",\"scout_researches\":" << stats.scout_researches
+     << ",\"aspiration_researches\":" << stats.aspiration_researches
+     << ",\"repetitions\":" << stats.repetitions
+     << ",\"null_move_cutoffs\":" << stats.null_move_cutoffs
+     << ",\"reductions\":" << stats.reductions
+     << ",\"futility_prunes\":" << stats.futility_prunes
+     << ",\"quiescence_nodes\":" << stats.quiescence_nodes
+     << ",\"delta_prunes\":" << stats.delta_prunes
+     << ",\"see_prunes\":" << stats.see_prunes;
+  // The growth of the nodes of the main thread over its last iteration.
+  double branching = 0;
+  if (iterations.size() >= 2) {
+    const uint64_t last = std::get<2>(iterations.back());
+    const uint64_t prev = std::get<2>(iterations[iterations.size() - 2]);
+    const uint64_t prev_prev =
+        iterations.size() >= 3 ? std::get<2>(iterations[iterations.size() - 3])
+                               : 0;
+    branching = Ratio(last - prev, prev - prev_prev);
+  }
+  os << ",\"ebf\":" << branching << ",\"iterations\":[";
+  uint64_t prev_nodes = 0;
+  for (size_t i = 0; i < iterations.size(); ++i) {
+    const auto [iteration_depth, iteration_elapsed, nodes] = iterations[i];
+    os << (i > 0 ? "," : "") << "{\"depth\":" << iteration_depth
+       << ",\"time_ms\":" << iteration_elapsed
+       << ",\"nodes\":" << nodes - prev_nodes << "}";
+    prev_nodes = nodes;
+  }
+  os << "]}";
+  std::cerr << os.str() << std::endl;
 }
 
 void Agent::TraceMoves() {
+  StopPondering();
   ChessColor color = color_;
-  BoardUpdater updater(board_);
-  for (size_t i = 0; i < depth_limit_; ++i) {
+  Searcher &searcher = *searchers_[0];
+  ChessBoard board = board_;
+  // GenerateMove leaves the stop flag raised for its helpers, and its node
+  // limit would cut the trace.
+  stop_.store(false);
+  searcher.SetNodeLimit(0);
+  for (int i = 0; i < depth_limit_; ++i) {
+    searcher.NewSearch(board, color);
     std::cout << "NegaScout score = "
-              << NegaScout(-kInf, kInf, depth_limit_ - i, color, true, updater)
+              << searcher.NegaScout(-kInf, kInf, depth_limit_ - i, color, true)
               << "\n";
-    std::cout << "best_move = " << best_move_ << "\n";
-    board_.MakeMove(best_move_);
-    std::cout << "board = " << board_ << "\n";
+    std::cout << "best_move = " << searcher.GetBestMove() << "\n";
+    // The outcome of a flip is unknown, so the trace stops there.
+    if (searcher.GetBestMove().IsNull() || searcher.GetBestMove().IsFlip())
+      break;
+    board.MakeMove(searcher.GetBestMove());
+    color = color ^ 1;
+    std::cout << "board = " << board << "\n";
   }
 }
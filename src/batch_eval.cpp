@@ -0,0 +1,196 @@
+#include "batch_eval.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace {
+
+// The dot product of x and y over n entries. The partial sums of the lanes
+// are kept apart so that the compiler can vectorize the loop without
+// reassociating floating-point additions.
+template <class T>
+float Dot(const float *x, const T *y, size_t n) {
+  constexpr size_t kLanes = 16;
+  std::array<float, kLanes> sums{};
+  size_t i = 0;
+  for (; i + kLanes <= n; i += kLanes) {
+    for (size_t j = 0; j < kLanes; ++j) sums[j] += x[i + j] * y[i + j];
+  }
+  float sum = 0;
+  for (; i < n; ++i) sum += x[i] * y[i];
+  for (float s : sums) sum += s;
+  return sum;
+}
+
+// Adds w times x to sums over n entries.
+void AddScaled(float w, const int8_t *x, size_t n, float *sums) {
+  for (size_t i = 0; i < n; ++i) sums[i] += w * x[i];
+}
+
+}  // namespace
+
+EvalWeights EvalWeights::Default() {
+  EvalWeights weights;
+  for (size_t t = 0; t < kNumChessPieces; ++t)
+    weights.values[t] = ChessBoard::kPieceValue[t];
+  weights.values[kSoldierRevealed] = ChessBoard::kSoldierValueRevealed;
+  weights.values[kCannonRevealed] = ChessBoard::kCannonValueRevealed;
+  weights.values[kSoldierCovered] = ChessBoard::kSoldierValueCovered;
+  weights.values[kCannonCovered] = ChessBoard::kCannonValueCovered;
+  weights.values[kCoefCovered] = ChessBoard::kCoefCovered;
+  weights.values[kCoefDangerous] = ChessBoard::kCoefDangerous;
+  weights.values[kDominateScore] = ChessBoard::kDominateScore;
+  return weights;
+}
+
+std::ostream &operator<<(std::ostream &os, const EvalWeights &weights) {
+  const auto &w = weights.values;
+  os << "kPieceValue = {";
+  for (size_t t = 0; t < kNumChessPieces; ++t)
+    os << (t > 0 ? ", " : "") << w[t];
+  return os << "}\n"
+            << "kSoldierValueRevealed = " << w[EvalWeights::kSoldierRevealed]
+            << "\nkCannonValueRevealed = " << w[EvalWeights::kCannonRevealed]
+            << "\nkSoldierValueCovered = " << w[EvalWeights::kSoldierCovered]
+            << "\nkCannonValueCovered = " << w[EvalWeights::kCannonCovered]
+            << "\nkCoefCovered = " << w[EvalWeights::kCoefCovered]
+            << "\nkCoefDangerous = " << w[EvalWeights::kCoefDangerous]
+            << "\nkDominateScore = " << w[EvalWeights::kDominateScore]
+            << "\n";
+}
+
+void BatchEvaluator::Add(const ChessBoard &board) {
+  const auto covered = board.GetCoveredPieces();
+  std::array<bool, 2> general_revealed = {false, false};
+  for (uint8_t pos = 0; pos < 32; ++pos) {
+    const ChessPiece piece = board.GetPiece(pos);
+    if (piece == RED_GENERAL || piece == BLACK_GENERAL)
+      general_revealed[GetChessPieceColor(piece)] = true;
+  }
+  // The value each piece is worth, as in ChessBoard::GetPieceValue.
+  auto GetValue = [&](ChessPiece piece) -> size_t {
+    const ChessPiece type = GetChessPieceType(piece);
+    const ChessColor opponent = GetChessPieceColor(piece) ^ 1;
+    if (type != SOLDIER && type != CANNON) return type;
+    if (general_revealed[opponent]) {
+      return type == SOLDIER ? EvalWeights::kSoldierRevealed
+                             : EvalWeights::kCannonRevealed;
+    }
+    if (covered[opponent * kNumChessPieces + GENERAL] > 0) {
+      return type == SOLDIER ? EvalWeights::kSoldierCovered
+                             : EvalWeights::kCannonCovered;
+    }
+    return type;
+  };
+
+  std::array<int8_t, kNumValues> num_uncovered{}, num_covered{},
+      num_attacked{};
+  const uint32_t under_attack = board.MarkUnderAttack();
+  for (uint8_t pos = 0; pos < 32; ++pos) {
+    const ChessPiece piece = board.GetPiece(pos);
+    if (piece == NO_PIECE || piece == COVERED_PIECE) continue;
+    const int sign = GetChessPieceColor(piece) == RED ? 1 : -1;
+    num_uncovered[GetValue(piece)] += sign;
+    if (under_attack >> pos & 1) num_attacked[GetValue(piece)] += sign;
+  }
+  for (size_t i = 0; i < covered.size(); ++i) {
+    const int sign = GetChessPieceColor(ChessPiece(i)) == RED ? 1 : -1;
+    num_covered[GetValue(ChessPiece(i))] += sign * covered[i];
+  }
+  for (size_t k = 0; k < kNumValues; ++k) {
+    uncovered_[k].push_back(num_uncovered[k]);
+    covered_[k].push_back(num_covered[k]);
+    attacked_[k].push_back(num_attacked[k]);
+  }
+
+  ChessColor winner;
+  uint8_t num_left;
+  if (board.FindDominance(&winner, &num_left)) {
+    scale_.push_back(0);
+    dominance_.push_back((winner == RED ? 1.0F : -1.0F) / (num_left + 1));
+  } else {
+    const uint32_t count = board.GetNoFlipCaptureCount();
+    const uint32_t limit = ChessBoard::GetNoFlipCaptureCountLimit();
+    float scale = 1;
+    if (count >= limit / 6) scale /= 2;
+    if (count >= limit / 2) scale /= 2;
+    scale_.push_back(scale);
+    dominance_.push_back(0);
+  }
+
+#ifndef NDEBUG
+  float score;
+  Evaluate(EvalWeights::Default(), GetSize() - 1, GetSize(), &score);
+  const float expected = board.Evaluate(RED);
+  assert(std::abs(score - expected) <=
+         1E-3 * std::max(1.0F, std::abs(expected)));
+#endif
+}
+
+void BatchEvaluator::EvaluateBlock(const EvalWeights &weights, size_t begin,
+                                   size_t n, float *scores) const {
+  const auto &w = weights.values;
+  // A covered piece is worth 1 / kCoefCovered of its value, and a piece
+  // under attack loses 1 - 1 / kCoefDangerous of it.
+  const float covered = 1 / w[EvalWeights::kCoefCovered];
+  const float attacked = 1 / w[EvalWeights::kCoefDangerous] - 1;
+  std::array<float, kBlockSize> sums{};
+  for (size_t k = 0; k < kNumValues; ++k) {
+    AddScaled(w[k], uncovered_[k].data() + begin, n, sums.data());
+    AddScaled(w[k] * covered, covered_[k].data() + begin, n, sums.data());
+    AddScaled(w[k] * attacked, attacked_[k].data() + begin, n, sums.data());
+  }
+  const float *scale = scale_.data() + begin;
+  const float *dominance = dominance_.data() + begin;
+  const float dominate = w[EvalWeights::kDominateScore];
+  for (size_t i = 0; i < n; ++i)
+    scores[i] = sums[i] * scale[i] + dominate * dominance[i];
+}
+
+void BatchEvaluator::Evaluate(const EvalWeights &weights, size_t begin,
+                              size_t end, float *scores) const {
+  for (size_t b = begin; b < end; b += kBlockSize) {
+    EvaluateBlock(weights, b, std::min(kBlockSize, end - b),
+                  scores + (b - begin));
+  }
+}
+
+void BatchEvaluator::AddGradient(
+    const EvalWeights &weights, size_t begin, size_t end,
+    const float *derivatives,
+    std::array<double, EvalWeights::kNumWeights> *gradient) const {
+  const auto &w = weights.values;
+  const float covered = 1 / w[EvalWeights::kCoefCovered];
+  const float attacked = 1 / w[EvalWeights::kCoefDangerous] - 1;
+  // The sums of the scaled derivatives times each count.
+  std::array<double, kNumValues> sum_uncovered{}, sum_covered{},
+      sum_attacked{};
+  double sum_dominance = 0;
+  std::array<float, kBlockSize> scaled;
+  for (size_t b = begin; b < end; b += kBlockSize) {
+    const size_t n = std::min(kBlockSize, end - b);
+    const float *d = derivatives + (b - begin);
+    const float *scale = scale_.data() + b;
+    for (size_t i = 0; i < n; ++i) scaled[i] = d[i] * scale[i];
+    for (size_t k = 0; k < kNumValues; ++k) {
+      sum_uncovered[k] += Dot(scaled.data(), uncovered_[k].data() + b, n);
+      sum_covered[k] += Dot(scaled.data(), covered_[k].data() + b, n);
+      sum_attacked[k] += Dot(scaled.data(), attacked_[k].data() + b, n);
+    }
+    sum_dominance += Dot(d, dominance_.data() + b, n);
+  }
+
+  double covered_value = 0, attacked_value = 0;
+  for (size_t k = 0; k < kNumValues; ++k) {
+    (*gradient)[k] += sum_uncovered[k] + covered * sum_covered[k] +
+                      attacked * sum_attacked[k];
+    covered_value += w[k] * sum_covered[k];
+    attacked_value += w[k] * sum_attacked[k];
+  }
+  // The derivative of 1 / x is -1 / x^2.
+  (*gradient)[EvalWeights::kCoefCovered] -= covered_value * covered * covered;
+  (*gradient)[EvalWeights::kCoefDangerous] -=
+      attacked_value * (attacked + 1) * (attacked + 1);
+  (*gradient)[EvalWeights::kDominateScore] += sum_dominance;
+}
@@ -0,0 +1,91 @@
+#include "book.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+constexpr uint32_t kKeyBits = sizeof(HashKey) * 8;
+
+bool CompareKeys(const BookEntry &a, const BookEntry &b) {
+  return a.key < b.key;
+}
+
+}  // namespace
+
+OpeningBook::OpeningBook()
+    : entries_(nullptr), num_entries_(0), mapping_(nullptr), mapping_size_(0) {}
+
+OpeningBook::~OpeningBook() { Unload(); }
+
+void OpeningBook::Unload() {
+  if (mapping_) munmap(mapping_, mapping_size_);
+  entries_ = nullptr;
+  num_entries_ = 0;
+  mapping_ = nullptr;
+  mapping_size_ = 0;
+}
+
+bool OpeningBook::Write(const std::string &path,
+                        std::vector<BookEntry> entries) {
+  std::sort(entries.begin(), entries.end(), CompareKeys);
+  std::array<char, kHeaderSize> header{};
+  const uint64_t num_entries = entries.size();
+  std::memcpy(header.data(), kMagic, sizeof(kMagic));
+  std::memcpy(header.data() + 4, &kKeyBits, sizeof(kKeyBits));
+  std::memcpy(header.data() + 8, &num_entries, sizeof(num_entries));
+  std::ofstream out(path, std::ios::binary);
+  out.write(header.data(), header.size());
+  out.write(reinterpret_cast<const char *>(entries.data()),
+            entries.size() * sizeof(BookEntry));
+  return static_cast<bool>(out);
+}
+
+bool OpeningBook::Load(const std::string &path) {
+  Unload();
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  void *addr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(kHeaderSize)) {
+    addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (addr == MAP_FAILED) return false;
+  const size_t size = st.st_size;
+  const auto *data = static_cast<const char *>(addr);
+
+  uint32_t key_bits;
+  uint64_t num_entries;
+  std::memcpy(&key_bits, data + 4, sizeof(key_bits));
+  std::memcpy(&num_entries, data + 8, sizeof(num_entries));
+  if (std::memcmp(data, kMagic, sizeof(kMagic)) != 0 ||
+      key_bits != kKeyBits ||
+      size != kHeaderSize + num_entries * sizeof(BookEntry)) {
+    munmap(addr, size);
+    return false;
+  }
+  mapping_ = addr;
+  mapping_size_ = size;
+  entries_ = reinterpret_cast<const BookEntry *>(data + kHeaderSize);
+  num_entries_ = num_entries;
+  return true;
+}
+
+bool OpeningBook::Probe(const ChessBoard &board, ChessMove *mv) const {
+  if (num_entries_ == 0) return false;
+  BookEntry target{};
+  target.key = GetKey(board);
+  const BookEntry *end = entries_ + num_entries_;
+  const BookEntry *it = std::lower_bound(entries_, end, target, CompareKeys);
+  if (it == end || it->key != target.key) return false;
+  *mv = it->move;
+  return true;
+}
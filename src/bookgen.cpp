@@ -0,0 +1,156 @@
+// Builds the opening book: every position the engine may have to move in
+// within the first --plies plies is searched to --depth and its best move is
+// written to --out. The opponent may answer with any move, while the engine
+// is assumed to follow the book, so that the positions grow by a factor of
+// about 400 per move of the opponent rather than per ply.
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "book.h"
+#include "chess.h"
+#include "hash.h"
+#include "searcher.h"
+#include "tablebase.h"
+
+namespace {
+
+struct Node {
+  ChessBoard board;
+  ChessColor player;
+};
+
+// Appends to *out the children of node by mv, one per outcome of a flip.
+void AppendChildren(const Node &node, ChessMove mv, std::vector<Node> *out) {
+  if (!mv.IsFlip()) {
+    Node child = node;
+    child.board.MakeMove(mv);
+    child.player = ChessColor(node.player ^ 1);
+    out->push_back(child);
+    return;
+  }
+  const auto covered = node.board.GetCoveredPieces();
+  for (size_t piece = 0; piece < covered.size(); ++piece) {
+    if (covered[piece] == 0) continue;
+    Node child = node;
+    child.board.MakeMove(Flip(mv.GetPos(), ChessPiece(piece)));
+    // The first flip gives the player the color of the revealed piece.
+    child.player = ChessColor(
+        (node.player == UNKNOWN ? GetChessPieceColor(ChessPiece(piece))
+                                : node.player) ^
+        1);
+    out->push_back(child);
+  }
+}
+
+// Appends to *out the children of node by every move.
+void AppendAllChildren(const Node &node, std::vector<Node> *out) {
+  if (node.board.Terminate()) return;
+  for (uint32_t mask = node.board.GetCoveredSquares(); mask > 0;
+       mask &= mask - 1) {
+    AppendChildren(node, Flip(__builtin_ctz(mask)), out);
+  }
+  if (node.player == UNKNOWN) return;
+  for (ChessMove mv : node.board.ListMoves(node.player))
+    AppendChildren(node, mv, out);
+}
+
+// Searches every node to depth on num_threads threads sharing table.
+std::vector<BookEntry> SearchAll(const std::vector<Node> &nodes, int depth,
+                                 size_t num_threads,
+                                 TranspositionTable<ChessMove> &table) {
+  const Tablebase tablebase;
+  const std::atomic<bool> stop(false);
+  std::vector<BookEntry> entries(nodes.size());
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    Searcher searcher(table, tablebase, stop);
+    for (size_t i; (i = next.fetch_add(1)) < nodes.size();) {
+      searcher.NewSearch(nodes[i].board, nodes[i].player);
+      for (int d = 1; d <= depth; ++d)
+        searcher.SearchSingleDepth(-Searcher::kInf, Searcher::kInf, d);
+      BookEntry &entry = entries[i];
+      entry.key = OpeningBook::GetKey(nodes[i].board);
+      entry.score = searcher.GetCompletedScore();
+      entry.move = searcher.GetCompletedMove();
+      entry.depth = searcher.GetCompletedDepth();
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; ++i) threads.emplace_back(work);
+  work();
+  for (auto &thread : threads) thread.join();
+  return entries;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  int max_ply = 1, depth = 4;
+  size_t num_threads = std::max(1U, std::thread::hardware_concurrency());
+  size_t hash_mb = TranspositionTable<ChessMove>::kDefaultSizeMB;
+  std::string out = "book.bin";
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg.substr(0, 8) == "--plies=") {
+      max_ply = std::stoi(std::string(arg.substr(8)));
+    } else if (arg.substr(0, 8) == "--depth=") {
+      depth = std::stoi(std::string(arg.substr(8)));
+    } else if (arg.substr(0, 10) == "--threads=") {
+      num_threads = std::max(1UL, std::stoul(std::string(arg.substr(10))));
+    } else if (arg.substr(0, 7) == "--hash=") {
+      hash_mb = std::stoul(std::string(arg.substr(7)));
+    } else if (arg.substr(0, 6) == "--out=") {
+      out = arg.substr(6);
+    } else {
+      std::cerr << "Unrecognized argument: " << arg << std::endl;
+      exit(1);
+    }
+  }
+
+  TranspositionTable<ChessMove> table(hash_mb);
+  std::vector<BookEntry> book;
+  std::unordered_set<uint64_t> seen;
+  // The positions of the ply where the opponent is to move, reached either
+  // from the start or by a book move of the previous ply. The engine always
+  // opens by flipping a1.
+  std::vector<Node> replies = {{ChessBoard(), UNKNOWN}};
+  std::vector<Node> answered;
+  AppendChildren({ChessBoard(), UNKNOWN}, Flip(0), &answered);
+  for (int ply = 1; ply <= max_ply; ++ply) {
+    std::vector<Node> children, nodes;
+    for (const Node &node : replies) AppendAllChildren(node, &children);
+    for (const Node &node : children) {
+      if (!node.board.Terminate() &&
+          seen.insert(OpeningBook::GetKey(node.board)).second) {
+        nodes.push_back(node);
+      }
+    }
+    std::cout << "ply " << ply << ": searching " << nodes.size()
+              << " positions" << std::endl;
+    table.NewSearch();
+    std::vector<BookEntry> entries =
+        SearchAll(nodes, depth, num_threads, table);
+
+    replies = std::move(answered);
+    answered.clear();
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      if (entries[i].move.IsNull()) continue;
+      book.push_back(entries[i]);
+      AppendChildren(nodes[i], entries[i].move, &answered);
+    }
+  }
+  if (!OpeningBook::Write(out, book)) {
+    std::cerr << "Cannot write " << out << std::endl;
+    exit(1);
+  }
+  std::cout << "Wrote " << book.size() << " positions to " << out
+            << std::endl;
+  return 0;
+}
@@ -5,263 +5,268 @@
 #include <iostream>
 #include <random>
 
-constexpr ChessPiece GetChessPieceType(ChessPiece piece) {
-  uint8_t p = piece;
-  if (p >= kNumChessPieces) p -= kNumChessPieces;
-  return ChessPiece(p);
-}
-
-constexpr ChessColor GetChessPieceColor(ChessPiece piece) {
-  return ChessColor(piece >= kNumChessPieces);
-}
-
-bool CanCapture(ChessPiece capturer, ChessPiece capturee) {
-  assert(capturer != COVERED_PIECE && capturer != NO_PIECE);
-  if (capturee == COVERED_PIECE) return false;
-  if (capturee == NO_PIECE) return true;
-  if (GetChessPieceColor(capturer) == GetChessPieceColor(capturee))
-    return false;
-
-  capturer = GetChessPieceType(capturer);
-  capturee = GetChessPieceType(capturee);
-  if (capturer == GENERAL && capturee == SOLDIER) return false;
-  if (capturer == SOLDIER && capturee == GENERAL) return true;
-  if (capturer == CANNON) return true;
-  return capturer >= capturee;
-}
-
 ChessBoard::ChessBoard()
-    : num_covered_pieces_{16, 16},
-      num_pieces_left_{16, 16},
+    : hash_value_(0),
       uncovered_squares_{0, 0},
       covered_squares_(static_cast<uint32_t>(-1)),
       no_flip_capture_count_(0),
-      current_player_(UNKNOWN),
-      hash_value_(0),
-      hasher_(0x7122) {
-  std::fill(board_.begin(), board_.end(), COVERED_PIECE);
-  covered_[RED_GENERAL] = covered_[BLACK_GENERAL] = 1;
-  covered_[RED_ADVISOR] = covered_[BLACK_ADVISOR] = 2;
-  covered_[RED_ELEPHANT] = covered_[BLACK_ELEPHANT] = 2;
-  covered_[RED_CHARIOT] = covered_[BLACK_CHARIOT] = 2;
-  covered_[RED_HORSE] = covered_[BLACK_HORSE] = 2;
-  covered_[RED_CANNON] = covered_[BLACK_CANNON] = 2;
-  covered_[RED_SOLDIER] = covered_[BLACK_SOLDIER] = 5;
+      current_player_(UNKNOWN) {
+  // The number of pieces of each type of a color.
+  constexpr std::array<uint8_t, kNumChessPieces> kNumPieces = {5, 2, 2, 2,
+                                                               2, 2, 1};
+  for (size_t i = 0; i < kNumSquares; ++i) board_.Set(i, COVERED_PIECE);
+  for (size_t i = 0; i < kNumChessPieces * 2; ++i)
+    covered_.Set(i, kNumPieces[i % kNumChessPieces]);
+
+  hash_value_ = ComputeHashValue();
+}
 
-  for (size_t i = 0; i < kNumSquares; ++i)
-    hash_value_ ^= hasher_.GetPieceHash(i, COVERED_PIECE);
-  hash_value_ ^= hasher_.GetPlayerHash(UNKNOWN);
+std::array<ChessPiece, ChessBoard::kNumSquares> ChessBoard::ParseSquares(
+    const std::array<std::string, 8> &buffer) {
+  std::array<ChessPiece, kNumSquares> squares;
+  for (size_t i = 0; i < 8; ++i) {
+    assert(buffer[i].size() == 4);
+    for (size_t j = 0; j < 4; ++j)
+      squares[i * 4 + j] = kCharPieceMapping[buffer[i][j]];
+  }
+  return squares;
 }
 
 ChessBoard::ChessBoard(const std::array<std::string, 8> &buffer,
                        const std::array<uint8_t, kNumChessPieces * 2> &covered,
-                       ChessColor current_player)
-    : covered_(covered),
-      num_covered_pieces_{0, 0},
-      num_pieces_left_{0, 0},
-      uncovered_squares_{0, 0},
+                       ChessColor current_player,
+                       uint8_t no_flip_capture_count)
+    : ChessBoard(ParseSquares(buffer), covered, current_player,
+                 no_flip_capture_count) {}
+
+ChessBoard::ChessBoard(const std::array<ChessPiece, kNumSquares> &squares,
+                       const std::array<uint8_t, kNumChessPieces * 2> &covered,
+                       ChessColor current_player,
+                       uint8_t no_flip_capture_count)
+    : uncovered_squares_{0, 0},
       covered_squares_(0),
-      no_flip_capture_count_(0),
+      no_flip_capture_count_(no_flip_capture_count),
       current_player_(current_player) {
-  for (size_t i = 0; i < 8; ++i) {
-    assert(buffer[i].size() == 4);
-    for (size_t j = 0; j < 4; ++j)
-      board_[i * 4 + j] = kCharPieceMapping[buffer[i][j]];
-  }
-  for (size_t i = 0; i < covered_.size(); ++i) {
-    ChessColor color = GetChessPieceColor(ChessPiece(i));
-    num_pieces_left_[color] += covered_[i];
-    num_covered_pieces_[color] += covered_[i];
-  }
-  for (size_t i = 0; i < kNumSquares; ++i) {
-    if (board_[i] == NO_PIECE || board_[i] == COVERED_PIECE) continue;
-    num_pieces_left_[GetChessPieceColor(board_[i])]++;
-    uncovered_squares_[GetChessPieceColor(board_[i])] |= (1U << i);
-  }
+  for (size_t i = 0; i < covered.size(); ++i) covered_.Set(i, covered[i]);
   for (size_t i = 0; i < kNumSquares; ++i) {
-    if (board_[i] == COVERED_PIECE) covered_squares_ |= (1U << i);
+    const ChessPiece piece = squares[i];
+    board_.Set(i, piece);
+    if (piece == COVERED_PIECE) covered_squares_ |= (1U << i);
+    if (piece == NO_PIECE || piece == COVERED_PIECE) continue;
+    uncovered_squares_[GetChessPieceColor(piece)] |= (1U << i);
+    piece_counts_.Add(piece, 1);
   }
+  hash_value_ = ComputeHashValue();
 }
 
-uint8_t ChessBoard::GetCannonTarget(ChessColor color, uint8_t pos,
-                                    int d) const {
-  const uint32_t kNonEmpty =
-      covered_squares_ | uncovered_squares_[RED] | uncovered_squares_[BLACK];
-  bool found = false;
-  int x = pos;
-  while (true) {
-    if (x + d < 0 || x + d >= kNumSquares) break;
-    if (std::abs(d) == 1 && ((x % 4) + d < 0 || (x % 4) + d >= 4)) break;
-    x += d;
-    if (kNonEmpty >> x & 1) {
-      found = true;
-      break;
-    }
-  }
-  if (!found) return static_cast<uint8_t>(-1);
-  while (true) {
-    if (x + d < 0 || x + d >= kNumSquares) break;
-    if (std::abs(d) == 1 && ((x % 4) + d < 0 || (x % 4) + d >= 4)) break;
-    x += d;
-    if (kNonEmpty >> x & 1) {
-      if (uncovered_squares_[color ^ 1] >> x & 1) return x;
-      break;
-    }
-  }
-  return static_cast<uint8_t>(-1);
+std::array<uint8_t, kNumChessPieces * 2> ChessBoard::GetCoveredPieces() const {
+  std::array<uint8_t, kNumChessPieces * 2> covered;
+  for (size_t i = 0; i < covered.size(); ++i) covered[i] = covered_.Get(i);
+  return covered;
+}
+
+HashKey ChessBoard::ComputeHashValue() const {
+  HashKey hash_value = kPlayerKeys[current_player_];
+  for (size_t i = 0; i < kNumSquares; ++i)
+    hash_value ^= kPieceKeys[i][GetPiece(i)];
+  for (size_t i = 0; i < kNumChessPieces * 2; ++i)
+    hash_value ^= kCoveredKeys[i][covered_.Get(i)];
+  hash_value ^= kNoFlipCaptureKeys[std::min(no_flip_capture_count_,
+                                            kNoFlipCaptureCountLimit)];
+  return hash_value;
+}
+
+uint32_t ChessBoard::GetCannonTargets(uint8_t pos, uint32_t occupied) {
+  const uint8_t row = pos / 4, col = pos % 4;
+  uint32_t targets =
+      uint32_t(kCannonRankTargets[col][occupied >> (row * 4) & 0xF])
+      << (row * 4);
+  // Gather the bits of the column into an 8-bit occupancy.
+  uint32_t file = (occupied >> col) & 0x11111111;
+  file = (file | file >> 3) & 0x03030303;
+  file = (file | file >> 6) & 0x000F000F;
+  file = (file | file >> 12) & 0xFF;
+  targets |= kFileSpread[kCannonFileTargets[row][file]] << col;
+  return targets;
 }
 
 uint32_t ChessBoard::MarkUnderAttack() const {
   uint32_t under_attack = 0;
   for (ChessColor color : {RED, BLACK}) {
+    const uint32_t kOpponent = uncovered_squares_[color ^ 1];
     for (uint32_t mask = uncovered_squares_[color]; mask > 0;) {
-      int p = __builtin_ctz(mask & -mask);
-      assert(board_[p] != NO_PIECE);
-      bool is_cannon = (GetChessPieceType(board_[p]) == CANNON);
-      if (is_cannon) {
-        for (int d : {-4, -1, 1, 4}) {
-          uint8_t x = GetCannonTarget(color, p, d);
-          if (x != static_cast<uint8_t>(-1)) under_attack |= (1U << x);
-        }
+      int p = __builtin_ctz(mask);
+      assert(GetPiece(p) != NO_PIECE);
+      if (GetChessPieceType(GetPiece(p)) == CANNON) {
+        under_attack |= GetCannonTargets(p) & kOpponent;
       } else {
-        for (int d : {-4, -1, 1, 4}) {
-          if (p + d < 0 || p + d >= kNumSquares) continue;
-          if (std::abs(d) == 1 && ((p % 4) + d < 0 || (p % 4) + d >= 4))
-            continue;
-          if (under_attack >> (p + d) & 1) continue;
-          if (board_[p + d] == NO_PIECE || board_[p + d] == COVERED_PIECE)
-            continue;
-
-          if (CanCapture(board_[p], board_[p + d]))
-            under_attack ^= (1U << (p + d));
+        for (uint32_t adj = kNeighborMasks[p] & kOpponent & ~under_attack;
+             adj > 0; adj &= adj - 1) {
+          int q = __builtin_ctz(adj);
+          if (CanCapture(GetPiece(p), GetPiece(q))) under_attack |= (1U << q);
         }
       }
-      mask ^= (1U << p);
+      mask &= mask - 1;
     }
   }
   return under_attack;
 }
 
-std::vector<ChessMove> ChessBoard::ListMoves(ChessColor player) {
-  std::vector<ChessMove> moves;
+void ChessBoard::ListCaptures(ChessColor player, MoveList *moves) const {
+  const uint32_t kOpponent = uncovered_squares_[player ^ 1];
   for (uint32_t mask = uncovered_squares_[player]; mask > 0;) {
-    int p = __builtin_ctz(mask & -mask);
-    assert(board_[p] != NO_PIECE);
-    bool is_cannon = (GetChessPieceType(board_[p]) == CANNON);
-    if (is_cannon) {
-      for (int d : {-4, -1, 1, 4}) {
-        uint8_t x = GetCannonTarget(player, p, d);
-        if (x != static_cast<uint8_t>(-1)) moves.push_back(Move(p, x));
+    int p = __builtin_ctz(mask);
+    assert(GetPiece(p) != NO_PIECE);
+    if (GetChessPieceType(GetPiece(p)) == CANNON) {
+      for (uint32_t dst = GetCannonTargets(p) & kOpponent; dst > 0;
+           dst &= dst - 1) {
+        moves->push_back(Move(p, __builtin_ctz(dst)));
+      }
+    } else {
+      for (uint32_t dst = kNeighborMasks[p] & kOpponent; dst > 0;
+           dst &= dst - 1) {
+        int q = __builtin_ctz(dst);
+        if (CanCapture(GetPiece(p), GetPiece(q))) moves->push_back(Move(p, q));
       }
     }
-    for (int d : {-4, -1, 1, 4}) {
-      if (p + d < 0 || p + d >= kNumSquares) continue;
-      if (std::abs(d) == 1 && ((p % 4) + d < 0 || (p % 4) + d >= 4)) continue;
-      if (is_cannon && board_[p + d] != NO_PIECE) continue;
-      if (!CanCapture(board_[p], board_[p + d])) continue;
-      moves.push_back(Move(p, p + d));
-    }
-    mask ^= (1U << p);
+    mask &= mask - 1;
+  }
+}
+
+void ChessBoard::ListQuiets(ChessColor player, MoveList *moves) const {
+  const uint32_t kEmpty =
+      ~(covered_squares_ | uncovered_squares_[RED] | uncovered_squares_[BLACK]);
+  for (uint32_t mask = uncovered_squares_[player]; mask > 0;) {
+    int p = __builtin_ctz(mask);
+    for (uint32_t dst = kNeighborMasks[p] & kEmpty; dst > 0; dst &= dst - 1)
+      moves->push_back(Move(p, __builtin_ctz(dst)));
+    mask &= mask - 1;
   }
+}
+
+MoveList ChessBoard::ListMoves(ChessColor player) const {
+  MoveList moves;
+  ListCaptures(player, &moves);
   // Move ordering.
-  std::sort(moves.begin(), moves.end(),
-            [&](const ChessMove &v1, const ChessMove &v2) {
-              const auto &x = std::get<Move>(v1);
-              const auto &y = std::get<Move>(v2);
-              if (board_[x.dst] == NO_PIECE) return false;
-              if (board_[y.dst] == NO_PIECE) return true;
-              return board_[x.dst] > board_[y.dst];
-            });
+  std::sort(moves.begin(), moves.end(), [&](ChessMove x, ChessMove y) {
+    return GetCaptureScore(x) > GetCaptureScore(y);
+  });
+  ListQuiets(player, &moves);
   return moves;
 }
 
 void ChessBoard::UpdateBoard(uint8_t pos, ChessPiece piece) {
-  hash_value_ ^= hasher_.GetPieceHash(pos, board_[pos]);
-  board_[pos] = piece;
-  hash_value_ ^= hasher_.GetPieceHash(pos, board_[pos]);
+  const ChessPiece old = GetPiece(pos);
+  if (old != NO_PIECE && old != COVERED_PIECE) piece_counts_.Add(old, -1);
+  hash_value_ ^= kPieceKeys[pos][old] ^ kPieceKeys[pos][piece];
+  board_.Set(pos, piece);
+  if (piece != NO_PIECE && piece != COVERED_PIECE) piece_counts_.Add(piece, 1);
 }
 
 void ChessBoard::UpdatePlayer(ChessColor new_player) {
-  hash_value_ ^= hasher_.GetPlayerHash(current_player_);
+  hash_value_ ^= kPlayerKeys[current_player_];
   current_player_ = new_player;
-  hash_value_ ^= hasher_.GetPlayerHash(current_player_);
+  hash_value_ ^= kPlayerKeys[current_player_];
+}
+
+void ChessBoard::UpdateCovered(ChessPiece piece, uint8_t count) {
+  hash_value_ ^= kCoveredKeys[piece][covered_.Get(piece)];
+  covered_.Set(piece, count);
+  hash_value_ ^= kCoveredKeys[piece][count];
 }
 
-void ChessBoard::MakeMove(const ChessMove &mv, BoardUpdater *updater) {
-  assert(current_player_ != UNKNOWN || std::holds_alternative<Flip>(mv));
-  no_flip_capture_count_++;
+void ChessBoard::UpdateNoFlipCaptureCount(uint8_t count) {
+  hash_value_ ^= kNoFlipCaptureKeys[std::min(no_flip_capture_count_,
+                                             kNoFlipCaptureCountLimit)];
+  no_flip_capture_count_ = count;
+  hash_value_ ^= kNoFlipCaptureKeys[std::min(no_flip_capture_count_,
+                                             kNoFlipCaptureCountLimit)];
+}
+
+void ChessBoard::MakeMove(ChessMove mv, BoardUpdater *updater) {
+  assert(current_player_ != UNKNOWN || mv.IsFlip());
+  UpdateNoFlipCaptureCount(no_flip_capture_count_ + 1);
   if (updater) updater->SaveMove(mv);
   bool flip_or_capture = false;
-  if (std::holds_alternative<Flip>(mv)) {
-    const auto &v = std::get<Flip>(mv);
-    assert(board_[v.pos] == COVERED_PIECE);
-    assert(covered_[v.result] > 0);
+  if (mv.IsFlip()) {
+    const uint8_t pos = mv.GetPos();
+    const ChessPiece result = mv.GetResult();
+    assert(GetPiece(pos) == COVERED_PIECE);
+    assert(covered_.Get(result) > 0);
     flip_or_capture = true;
 
     if (current_player_ == UNKNOWN) {
-      UpdatePlayer(GetChessPieceColor(v.result));
-      hash_value_ ^= hasher_.GetPlayerHash(UNKNOWN);
+      UpdatePlayer(GetChessPieceColor(result));
       if (updater) updater->SetIsInitial(true);
     }
 
-    UpdateBoard(v.pos, v.result);
-    covered_[v.result]--;
-    assert(!(uncovered_squares_[current_player_] >> v.pos & 1));
-    uncovered_squares_[GetChessPieceColor(v.result)] ^= (1U << v.pos);
-    num_covered_pieces_[GetChessPieceColor(v.result)]--;
-    covered_squares_ ^= (1U << v.pos);
+    UpdateBoard(pos, result);
+    UpdateCovered(result, covered_.Get(result) - 1);
+    assert(!(uncovered_squares_[current_player_] >> pos & 1));
+    uncovered_squares_[GetChessPieceColor(result)] ^= (1U << pos);
+    covered_squares_ ^= (1U << pos);
   } else {
-    const auto &v = std::get<Move>(mv);
-    assert(board_[v.src] != COVERED_PIECE && board_[v.src] != NO_PIECE);
-    assert(board_[v.dst] != COVERED_PIECE);
-    assert(CanCapture(board_[v.src], board_[v.dst]));
+    const uint8_t src = mv.GetSrc(), dst = mv.GetDst();
+    assert(GetPiece(src) != COVERED_PIECE && GetPiece(src) != NO_PIECE);
+    assert(GetPiece(dst) != COVERED_PIECE);
+    assert(CanCapture(GetPiece(src), GetPiece(dst)));
 
-    if (updater) updater->SaveCaptured(board_[v.dst]);
-    if (board_[v.dst] != NO_PIECE) {  // capture
+    if (updater) updater->SaveCaptured(GetPiece(dst));
+    if (GetPiece(dst) != NO_PIECE) {  // capture
       flip_or_capture = true;
-      assert(GetChessPieceColor(board_[v.dst]) == (current_player_ ^ 1));
-      assert(uncovered_squares_[current_player_ ^ 1] >> v.dst & 1);
-      num_pieces_left_[current_player_ ^ 1]--;
-      uncovered_squares_[current_player_ ^ 1] ^= (1U << v.dst);
+      assert(GetChessPieceColor(GetPiece(dst)) == (current_player_ ^ 1));
+      assert(uncovered_squares_[current_player_ ^ 1] >> dst & 1);
+      uncovered_squares_[current_player_ ^ 1] ^= (1U << dst);
     }
 
-    assert(uncovered_squares_[current_player_] >> v.src & 1);
-    assert(!(uncovered_squares_[current_player_] >> v.dst & 1));
-    uncovered_squares_[current_player_] ^= (1U << v.src);
-    uncovered_squares_[current_player_] ^= (1U << v.dst);
-    UpdateBoard(v.dst, board_[v.src]);
-    UpdateBoard(v.src, NO_PIECE);
+    assert(uncovered_squares_[current_player_] >> src & 1);
+    assert(!(uncovered_squares_[current_player_] >> dst & 1));
+    uncovered_squares_[current_player_] ^= (1U << src);
+    uncovered_squares_[current_player_] ^= (1U << dst);
+    UpdateBoard(dst, GetPiece(src));
+    UpdateBoard(src, NO_PIECE);
   }
 
   UpdatePlayer(current_player_ ^ 1);
   if (flip_or_capture) {
     if (updater) updater->SaveNoFlipCaptureCount(no_flip_capture_count_);
-    no_flip_capture_count_ = 0;
+    UpdateNoFlipCaptureCount(0);
   }
 }
 
+void ChessBoard::MakeNullMove(BoardUpdater *updater) {
+  assert(current_player_ != UNKNOWN);
+  UpdateNoFlipCaptureCount(no_flip_capture_count_ + 1);
+  if (updater) updater->SaveMove(ChessMove());
+  UpdatePlayer(current_player_ ^ 1);
+}
+
+uint8_t ChessBoard::GetNumPiecesLeft(ChessColor c) const {
+  return __builtin_popcount(uncovered_squares_[c]) + GetNumCoveredPieces(c);
+}
+
 bool ChessBoard::Terminate() const {
-  // TODO: Add other rules to it.
-  return num_pieces_left_[RED] == 0 || num_pieces_left_[BLACK] == 0 ||
+  // Repetitions are detected by the key history of Searcher::IsRepetition.
+  return GetNumPiecesLeft(RED) == 0 || GetNumPiecesLeft(BLACK) == 0 ||
          no_flip_capture_count_ == kNoFlipCaptureCountLimit;
 }
 
 ChessColor ChessBoard::GetWinner() const {
   if (no_flip_capture_count_ == kNoFlipCaptureCountLimit) return DRAW;
-  return num_pieces_left_[RED] == 0 ? BLACK : RED;
+  return GetNumPiecesLeft(RED) == 0 ? BLACK : RED;
 }
 
-float ChessBoard::Evaluate(ChessColor color) const {
-  static constexpr float kValue[7] = {1, 180, 6, 18, 90, 270, 810};
-  static constexpr float kCoefDangerous = 3;
+#ifndef NDEBUG
+
+float ChessBoard::EvaluateFull(ChessColor color) const {
   float score = 0;
   uint32_t under_attack = MarkUnderAttack();
   bool general_revealed[2] = {false, false};
-  bool general_covered[2] = {covered_[RED_GENERAL] > 0,
-                             covered_[BLACK_GENERAL] > 0};
+  bool general_covered[2] = {covered_.Get(RED_GENERAL) > 0,
+                             covered_.Get(BLACK_GENERAL) > 0};
   for (size_t i = 0; i < kNumSquares; ++i) {
-    if (board_[i] == RED_GENERAL) general_revealed[RED] = true;
-    if (board_[i] == BLACK_GENERAL) general_revealed[BLACK] = true;
+    if (GetPiece(i) == RED_GENERAL) general_revealed[RED] = true;
+    if (GetPiece(i) == BLACK_GENERAL) general_revealed[BLACK] = true;
   }
 
   auto GetValue = [&](ChessPiece piece) -> float {
@@ -270,13 +275,13 @@ float ChessBoard::Evaluate(ChessColor color) const {
     // The martial values of soldiers and cannon increase when the general shows
     // up in the endgame.
     if (general_revealed[opponent]) {
-      if (type == SOLDIER) return 20;
-      if (type == CANNON) return 250;
+      if (type == SOLDIER) return kSoldierValueRevealed;
+      if (type == CANNON) return kCannonValueRevealed;
     } else if (general_covered[opponent]) {
-      if (type == SOLDIER) return 10;
-      if (type == CANNON) return 200;
+      if (type == SOLDIER) return kSoldierValueCovered;
+      if (type == CANNON) return kCannonValueCovered;
     }
-    return kValue[type];
+    return kPieceValue[type];
   };
 
   std::array<std::array<uint8_t, kNumChessPieces>, 2> counter{};
@@ -286,12 +291,12 @@ float ChessBoard::Evaluate(ChessColor color) const {
   std::array<ChessPiece, kNumSquares> available_pieces;
   size_t ptr = 0;
   for (size_t i = 0; i < kNumSquares; ++i) {
-    if (board_[i] == NO_PIECE || board_[i] == COVERED_PIECE) continue;
-    counter[GetChessPieceColor(board_[i])][GetChessPieceType(board_[i])]++;
-    float v = GetValue(board_[i]);
+    if (GetPiece(i) == NO_PIECE || GetPiece(i) == COVERED_PIECE) continue;
+    counter[GetChessPieceColor(GetPiece(i))][GetChessPieceType(GetPiece(i))]++;
+    float v = GetValue(GetPiece(i));
     if (under_attack >> i & 1) v /= kCoefDangerous;
-    (GetChessPieceColor(board_[i]) == color) ? score += v : score -= v;
-    available_pieces[ptr++] = board_[i];
+    (GetChessPieceColor(GetPiece(i)) == color) ? score += v : score -= v;
+    available_pieces[ptr++] = GetPiece(i);
   }
   if (covered_squares_ == 0) {
     // If one of the pieces dominates all pieces of the opponent's, the value of
@@ -302,7 +307,6 @@ float ChessBoard::Evaluate(ChessColor color) const {
         counter[i][j] += counter[i][j - 1];
       }
     }
-    static constexpr float kDominateScore = 10000;
     for (size_t i = 0; i < ptr; ++i) {
       const auto &piece = available_pieces[i];
       auto type = GetChessPieceType(piece);
@@ -317,7 +321,7 @@ float ChessBoard::Evaluate(ChessColor color) const {
       } else if (type != CANNON) {
         // If the rooks are captured and all other pieces are of lower ranks.
         dominate = (counter[col ^ 1][CANNON] == counter[col ^ 1][CANNON - 1] &&
-                    counter[GENERAL] == counter[type - 1]);
+                    counter[col ^ 1][GENERAL] == counter[col ^ 1][type - 1]);
       }
       if (dominate) {
         // The score is kDominateScore divide by the number of remaining pieces
@@ -328,10 +332,9 @@ float ChessBoard::Evaluate(ChessColor color) const {
       }
     }
   } else {
-    static constexpr float kCoefCovered = 5;
     for (uint8_t i = 0; i < kNumChessPieces * 2; ++i) {
-      if (covered_[i] == 0) continue;
-      float v = GetValue(ChessPiece(i)) * covered_[i] / kCoefCovered;
+      if (covered_.Get(i) == 0) continue;
+      float v = GetValue(ChessPiece(i)) * covered_.Get(i) / kCoefCovered;
       (GetChessPieceColor(ChessPiece(i)) == color) ? score += v : score -= v;
     }
   }
@@ -340,14 +343,175 @@ float ChessBoard::Evaluate(ChessColor color) const {
   return score;
 }
 
-bool ChessBoard::Playable(const ChessMove &mv) const {
-  if (std::holds_alternative<Flip>(mv)) {
-    const auto &v = std::get<Flip>(mv);
-    return board_[v.pos] == COVERED_PIECE;
+#endif  // NDEBUG
+
+float ChessBoard::GetPieceValue(ChessPiece piece) const {
+  ChessPiece type = GetChessPieceType(piece);
+  ChessColor opponent = GetChessPieceColor(piece) ^ 1;
+  // The martial values of soldiers and cannon increase when the general shows
+  // up in the endgame.
+  if (piece_counts_.Get(opponent * kNumChessPieces + GENERAL) > 0) {
+    if (type == SOLDIER) return kSoldierValueRevealed;
+    if (type == CANNON) return kCannonValueRevealed;
+  } else if (covered_.Get(opponent * kNumChessPieces + GENERAL) > 0) {
+    if (type == SOLDIER) return kSoldierValueCovered;
+    if (type == CANNON) return kCannonValueCovered;
   }
-  const auto &v = std::get<Move>(mv);
-  if (board_[v.src] == COVERED_PIECE || board_[v.src] == NO_PIECE) return false;
-  return CanCapture(board_[v.src], board_[v.dst]);
+  return kPieceValue[type];
+}
+
+bool ChessBoard::FindDominance(ChessColor *color, uint8_t *num_left) const {
+  if (covered_squares_ != 0) return false;
+  std::array<std::array<uint8_t, kNumChessPieces>, 2> counter;
+  for (size_t i = 0; i < 2; ++i) {
+    counter[i][0] = piece_counts_.Get(i * kNumChessPieces);
+    for (size_t j = 1; j < kNumChessPieces; ++j) {
+      counter[i][j] =
+          counter[i][j - 1] + piece_counts_.Get(i * kNumChessPieces + j);
+    }
+  }
+  for (uint32_t mask = uncovered_squares_[RED] | uncovered_squares_[BLACK];
+       mask > 0; mask &= mask - 1) {
+    const ChessPiece piece = GetPiece(__builtin_ctz(mask));
+    auto type = GetChessPieceType(piece);
+    auto col = GetChessPieceColor(piece);
+    bool dominate = false;
+    if (type == SOLDIER) {
+      // If the general is the only piece left.
+      dominate = (counter[col ^ 1][GENERAL] == counter[col ^ 1][GENERAL - 1]);
+    } else if (type == GENERAL) {
+      // If all the soldiers are captured.
+      dominate = (counter[col ^ 1][SOLDIER] == 0);
+    } else if (type != CANNON) {
+      // If the rooks are captured and all other pieces are of lower ranks.
+      dominate = (counter[col ^ 1][CANNON] == counter[col ^ 1][CANNON - 1] &&
+                  counter[col ^ 1][GENERAL] == counter[col ^ 1][type - 1]);
+    }
+    if (dominate) {
+      *color = col;
+      *num_left = counter[col ^ 1][GENERAL];
+      return true;
+    }
+  }
+  return false;
+}
+
+float ChessBoard::Evaluate(ChessColor color) const {
+  float score = 0;
+  for (ChessColor c : {RED, BLACK}) {
+    // Start from the base values and correct those of soldiers and cannons.
+    const size_t base = c * kNumChessPieces;
+    float uncovered = 0, covered = 0;
+    for (size_t t = 0; t < kNumChessPieces; ++t) {
+      uncovered += kPieceValue[t] * piece_counts_.Get(base + t);
+      covered += kPieceValue[t] * covered_.Get(base + t);
+    }
+    float v = uncovered + covered / kCoefCovered;
+    v += (GetPieceValue(ChessPiece(base + SOLDIER)) - kPieceValue[SOLDIER]) *
+         (piece_counts_.Get(base + SOLDIER) +
+          covered_.Get(base + SOLDIER) / kCoefCovered);
+    v += (GetPieceValue(ChessPiece(base + CANNON)) - kPieceValue[CANNON]) *
+         (piece_counts_.Get(base + CANNON) +
+          covered_.Get(base + CANNON) / kCoefCovered);
+    (c == color) ? score += v : score -= v;
+  }
+  for (uint32_t mask = MarkUnderAttack(); mask > 0; mask &= mask - 1) {
+    ChessPiece piece = GetPiece(__builtin_ctz(mask));
+    float v = GetPieceValue(piece);
+    v -= v / kCoefDangerous;
+    (GetChessPieceColor(piece) == color) ? score -= v : score += v;
+  }
+  // If one of the pieces dominates all pieces of the opponent's, the value of
+  // the board will be proportional to the number of remaining pieces of the
+  // opponent's.
+  ChessColor winner;
+  uint8_t num_left;
+  if (FindDominance(&winner, &num_left)) {
+    // The score is kDominateScore divide by the number of remaining pieces
+    // plus 1.
+    float score = kDominateScore / (num_left + 1);
+    if (winner != color) score = -score;
+    assert(score == EvaluateFull(color));
+    return score;
+  }
+  if (no_flip_capture_count_ >= kNoFlipCaptureCountLimit / 6) score /= 2;
+  if (no_flip_capture_count_ >= kNoFlipCaptureCountLimit / 2) score /= 2;
+  assert(std::abs(score - EvaluateFull(color)) <=
+         1E-3 * std::max(1.0F, std::abs(score)));
+  return score;
+}
+
+bool ChessBoard::Playable(ChessMove mv) const {
+  if (mv.IsFlip()) return GetPiece(mv.GetPos()) == COVERED_PIECE;
+  if (current_player_ == UNKNOWN) return false;
+  const uint8_t src = mv.GetSrc(), dst = mv.GetDst();
+  if (!(uncovered_squares_[current_player_] >> src & 1)) return false;
+  if (GetChessPieceType(GetPiece(src)) == CANNON && GetPiece(dst) != NO_PIECE) {
+    return (GetCannonTargets(src) & uncovered_squares_[current_player_ ^ 1]) >>
+               dst &
+           1;
+  }
+  return (kNeighborMasks[src] >> dst & 1) &&
+         CanCapture(GetPiece(src), GetPiece(dst));
+}
+
+float ChessBoard::StaticExchange(ChessMove mv) const {
+  const uint8_t dst = mv.GetDst();
+  uint32_t occupied =
+      covered_squares_ | uncovered_squares_[RED] | uncovered_squares_[BLACK];
+  // The pieces of each color that may still take part, and the cannons among
+  // them, which capture from afar.
+  std::array<uint32_t, 2> pieces = uncovered_squares_;
+  std::array<uint32_t, 2> cannons{};
+  for (uint32_t mask = pieces[RED] | pieces[BLACK]; mask > 0;
+       mask &= mask - 1) {
+    const uint8_t p = __builtin_ctz(mask);
+    if (GetChessPieceType(GetPiece(p)) == CANNON)
+      cannons[GetChessPieceColor(GetPiece(p))] |= 1U << p;
+  }
+
+  // gain[d] is the balance of the side that made the d-th capture if the
+  // exchange stopped right after it.
+  std::array<float, 32> gain;
+  int d = 0;
+  gain[0] = GetPieceValue(GetPiece(dst));
+  uint8_t from = mv.GetSrc();
+  ChessPiece on_dst = GetPiece(from);
+  ChessColor side = GetChessPieceColor(on_dst);
+  while (true) {
+    ++d;
+    gain[d] = GetPieceValue(on_dst) - gain[d - 1];
+    // Neither side gains by going on.
+    if (std::max(-gain[d - 1], gain[d]) < 0) break;
+    occupied ^= 1U << from;
+    pieces[side] &= ~(1U << from);
+    cannons[side] &= ~(1U << from);
+    side ^= 1;
+    // The least valuable piece that can capture on_dst.
+    uint8_t best = kNumSquares;
+    for (uint32_t mask = kNeighborMasks[dst] & pieces[side] & ~cannons[side];
+         mask > 0; mask &= mask - 1) {
+      const uint8_t p = __builtin_ctz(mask);
+      if (CanCapture(GetPiece(p), on_dst) &&
+          (best == kNumSquares ||
+           GetPieceValue(GetPiece(p)) < GetPieceValue(GetPiece(best)))) {
+        best = p;
+      }
+    }
+    for (uint32_t mask = cannons[side]; mask > 0; mask &= mask - 1) {
+      const uint8_t p = __builtin_ctz(mask);
+      if ((GetCannonTargets(p, occupied) >> dst & 1) &&
+          (best == kNumSquares ||
+           GetPieceValue(GetPiece(p)) < GetPieceValue(GetPiece(best)))) {
+        best = p;
+      }
+    }
+    if (best == kNumSquares) break;
+    from = best;
+    on_dst = GetPiece(best);
+  }
+  while (--d > 0) gain[d - 1] = -std::max(-gain[d - 1], gain[d]);
+  return gain[0];
 }
 
 namespace {
@@ -359,39 +523,27 @@ void PrintSquare(std::ostream &os, uint8_t square) {
 
 }  // namespace
 
-std::ostream &operator<<(std::ostream &os, const Move &mv) {
-  PrintSquare(os, mv.src);
-  os << " ";
-  PrintSquare(os, mv.dst);
-  return os;
-}
-
-std::ostream &operator<<(std::ostream &os, const Flip &fp) {
-  PrintSquare(os, fp.pos);
+std::ostream &operator<<(std::ostream &os, const ChessMove &mv) {
+  PrintSquare(os, mv.GetSrc());
   os << " ";
-  PrintSquare(os, fp.pos);
+  PrintSquare(os, mv.GetDst());
   return os;
 }
 
-std::ostream &operator<<(std::ostream &os, const ChessMove &mv) {
-  if (std::holds_alternative<Move>(mv)) return os << std::get<Move>(mv);
-  return os << std::get<Flip>(mv);
-}
-
 std::ostream &operator<<(std::ostream &os, const ChessBoard &board) {
-  os << "num_pieces_left[RED] = " << int(board.num_pieces_left_[RED])
-     << " num_pieces_left_[BLACK] = " << int(board.num_pieces_left_[BLACK])
+  os << "num_pieces_left[RED] = " << int(board.GetNumPiecesLeft(RED))
+     << " num_pieces_left_[BLACK] = " << int(board.GetNumPiecesLeft(BLACK))
+     << "\n";
+  os << "no_flip_capture_count = " << int(board.no_flip_capture_count_)
      << "\n";
-  os << "no_flip_capture_count = " << board.no_flip_capture_count_ << "\n";
   os << "covered: ";
-  for (size_t i = 0; i < board.covered_.size(); ++i)
-    os << int(board.covered_[i]) << " ";
+  for (uint8_t c : board.GetCoveredPieces()) os << int(c) << " ";
   os << "\n";
   os << "evaluation(RED) = " << board.Evaluate(RED)
      << " evaluation(BLACK) = " << board.Evaluate(BLACK) << "\n";
   for (int i = 7; i >= 0; --i) {
     for (int j = 0; j < 4; ++j)
-      os << ChessBoard::kPieceCharMapping[board.board_[i * 4 + j]];
+      os << ChessBoard::kPieceCharMapping[board.GetPiece(i * 4 + j)];
     os << "\n";
   }
   return os;
@@ -399,7 +551,7 @@ std::ostream &operator<<(std::ostream &os, const ChessBoard &board) {
 
 BoardUpdater::BoardUpdater(ChessBoard &b) : board_(b), is_initial_(false) {}
 
-void BoardUpdater::MakeMove(const ChessMove &mv) { board_.MakeMove(mv, this); }
+void BoardUpdater::MakeMove(ChessMove mv) { board_.MakeMove(mv, this); }
 
 void BoardUpdater::Rewind() {
   assert(!history_.empty());
@@ -410,37 +562,41 @@ void BoardUpdater::Rewind() {
 
 void BoardUpdater::UndoMove(ChessMove mv) {
   auto player = board_.current_player_ ^ 1;
+  if (mv.IsNull()) {
+    board_.UpdatePlayer(player);
+    board_.UpdateNoFlipCaptureCount(board_.no_flip_capture_count_ - 1);
+    return;
+  }
   bool flip_or_capture = false;
-  if (std::holds_alternative<Flip>(mv)) {
-    auto &v = std::get<Flip>(mv);
-    board_.UpdateBoard(v.pos, COVERED_PIECE);
-    board_.covered_[v.result]++;
-    board_.uncovered_squares_[GetChessPieceColor(v.result)] ^= (1U << v.pos);
-    board_.num_covered_pieces_[GetChessPieceColor(v.result)]++;
-    board_.covered_squares_ ^= (1U << v.pos);
+  if (mv.IsFlip()) {
+    const uint8_t pos = mv.GetPos();
+    const ChessPiece result = mv.GetResult();
+    board_.UpdateBoard(pos, COVERED_PIECE);
+    board_.UpdateCovered(result, board_.covered_.Get(result) + 1);
+    board_.uncovered_squares_[GetChessPieceColor(result)] ^= (1U << pos);
+    board_.covered_squares_ ^= (1U << pos);
     flip_or_capture = true;
   } else {
-    auto &v = std::get<Move>(mv);
+    const uint8_t src = mv.GetSrc(), dst = mv.GetDst();
     assert(!captured_.empty());
     ChessPiece capturee = captured_.back();
     captured_.pop_back();
     if (capturee != NO_PIECE) {
       flip_or_capture = true;
-      board_.num_pieces_left_[player ^ 1]++;
-      board_.uncovered_squares_[player ^ 1] ^= (1U << v.dst);
+      board_.uncovered_squares_[player ^ 1] ^= (1U << dst);
     }
 
-    board_.uncovered_squares_[player] ^= (1U << v.src);
-    board_.uncovered_squares_[player] ^= (1U << v.dst);
-    board_.UpdateBoard(v.src, board_.board_[v.dst]);
-    board_.UpdateBoard(v.dst, capturee);
+    board_.uncovered_squares_[player] ^= (1U << src);
+    board_.uncovered_squares_[player] ^= (1U << dst);
+    board_.UpdateBoard(src, board_.GetPiece(dst));
+    board_.UpdateBoard(dst, capturee);
   }
   board_.UpdatePlayer(player);
   if (flip_or_capture) {
     assert(!no_flip_capture_counts_.empty());
-    board_.no_flip_capture_count_ = no_flip_capture_counts_.back();
+    board_.UpdateNoFlipCaptureCount(no_flip_capture_counts_.back());
     no_flip_capture_counts_.pop_back();
   }
   assert(board_.no_flip_capture_count_ > 0);
-  board_.no_flip_capture_count_--;
+  board_.UpdateNoFlipCaptureCount(board_.no_flip_capture_count_ - 1);
 }
@@ -84,21 +84,34 @@ ChessPiece ParsePiece(std::string_view &cmd) {
 
 #ifndef NDEBUG
 
-constexpr char kCmdString[18][20] = {
+constexpr char kCmdString[19][20] = {
     "protocol_version",  "name",          "version",
     "known_command",     "list_commands", "quit",
     "boardsize",         "reset_board",   "num_repetition",
     "num_moves_to_draw", "move",          "flip",
     "genmove",           "game_over",     "ready",
-    "time_setting",      "time_left",     "showboard"};
+    "time_setting",      "time_left",     "showboard",
+    "setoption"};
 
 #endif
 
 }  // namespace
 
-int main() {
+int main(int argc, char **argv) {
   std::string buffer;
   Agent agent;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    size_t eq = arg.find('=');
+    if (arg.substr(0, 2) != "--" || eq == std::string_view::npos) {
+      std::cerr << "Unrecognized argument: " << arg << std::endl;
+      exit(1);
+    }
+    if (!agent.SetOption(arg.substr(2, eq - 2), arg.substr(eq + 1))) {
+      std::cerr << "Unsupported option: " << arg << std::endl;
+      exit(1);
+    }
+  }
   while (true) {
     std::getline(std::cin, buffer);
     std::cerr << "received: " << buffer << "\n";
@@ -114,6 +127,7 @@ int main() {
         std::cout << "=2 1.0.0" << std::endl;
         break;
       case 5:
+        agent.StopPondering();
         std::cout << "=5" << std::endl;
         exit(0);
       case 7:
@@ -164,6 +178,14 @@ int main() {
         std::cout << "=16" << std::endl;
         break;
       }
+      case 18: {
+        auto name = ParseString(cmd);
+        auto value = ParseString(cmd);
+        if (!agent.SetOption(name, value))
+          std::cerr << "Unsupported option: " << name << std::endl;
+        std::cout << "=18" << std::endl;
+        break;
+      }
       default:
         std::cerr << "Unsupported MGTP command: " << id << std::endl;
         exit(1);
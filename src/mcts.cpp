@@ -0,0 +1,234 @@
+#include "mcts.h"
+
+#include <cassert>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "chess.h"
+
+void Mcts::Node::Init(ChessMove mv, uint8_t w) {
+  visits.store(0, std::memory_order_relaxed);
+  rewards.store(0, std::memory_order_relaxed);
+  children = nullptr;
+  num_children = 0;
+  move = mv;
+  weight = w;
+  state.store(kUnexpanded, std::memory_order_relaxed);
+}
+
+float Mcts::Node::GetValue() const {
+  const uint32_t n = visits.load(std::memory_order_relaxed);
+  if (n == 0) return 0;
+  return static_cast<float>(rewards.load(std::memory_order_relaxed)) /
+         kRewardScale / n;
+}
+
+Mcts::Mcts(const std::atomic<bool> &stop, size_t size_mb)
+    : stop_(stop),
+      done_(false),
+      num_iterations_(0),
+      playouts_(false),
+      network_(nullptr) {
+  Resize(size_mb);
+}
+
+void Mcts::Resize(size_t size_mb) {
+  arena_.Resize(std::max<size_t>(size_mb * (1 << 20) / sizeof(Node), 1));
+}
+
+float Mcts::EvaluateLeaf(const ChessBoard &board, PlayoutRng *rng) const {
+  if (playouts_) {
+    const ChessColor winner = PlayoutBoard(board).Playout(rng);
+    return winner == DRAW                        ? 0.5
+           : winner == board.GetCurrentPlayer() ? 1
+                                                : 0;
+  }
+  const ChessColor color = board.GetCurrentPlayer();
+  const float score = network_ != nullptr && network_->IsLoaded()
+                          ? network_->Evaluate(board, color)
+                          : board.Evaluate(color);
+  return 1 / (1 + std::exp(-score / kEvalScale));
+}
+
+bool Mcts::Expand(const ChessBoard &board, Node *node) {
+  uint8_t expected = kUnexpanded;
+  if (!node->state.compare_exchange_strong(expected, kExpanding,
+                                           std::memory_order_acquire)) {
+    return false;
+  }
+  Node *children = nullptr;
+  size_t n = 0;
+  if (node->IsChance()) {
+    const uint8_t pos = node->move.GetPos();
+    const auto covered = board.GetCoveredPieces();
+    for (uint8_t count : covered) n += count > 0;
+    if ((children = arena_.Allocate(n)) != nullptr) {
+      Node *child = children;
+      for (size_t piece = 0; piece < covered.size(); ++piece) {
+        if (covered[piece] > 0)
+          (child++)->Init(Flip(pos, ChessPiece(piece)), covered[piece]);
+      }
+    }
+  } else {
+    const MoveList moves = board.ListMoves(board.GetCurrentPlayer());
+    const uint32_t flips = board.GetCoveredSquares();
+    n = moves.size() + __builtin_popcount(flips);
+    if (n > 0 && (children = arena_.Allocate(n)) != nullptr) {
+      Node *child = children;
+      for (ChessMove mv : moves) (child++)->Init(mv, 1);
+      for (uint32_t mask = flips; mask > 0; mask &= mask - 1)
+        (child++)->Init(Flip(__builtin_ctz(mask)), 1);
+    }
+  }
+  if (n > 0 && children == nullptr) {
+    // Out of nodes: the node stays a leaf.
+    node->state.store(kUnexpanded, std::memory_order_relaxed);
+    return false;
+  }
+  node->children = children;
+  node->num_children = n;
+  node->state.store(kExpanded, std::memory_order_release);
+  return true;
+}
+
+Mcts::Node *Mcts::SelectChild(Node *node) const {
+  const float log_visits = std::log(
+      static_cast<float>(node->visits.load(std::memory_order_relaxed)));
+  Node *best = nullptr;
+  float best_score = -std::numeric_limits<float>::infinity();
+  for (Node *child = node->children;
+       child != node->children + node->num_children; ++child) {
+    const uint32_t n = child->visits.load(std::memory_order_relaxed);
+    if (n == 0) return child;
+    const float score =
+        child->GetValue() + kExploration * std::sqrt(log_visits / n);
+    if (score > best_score) {
+      best_score = score;
+      best = child;
+    }
+  }
+  return best;
+}
+
+Mcts::Node *Mcts::SelectOutcome(Node *node) const {
+  // The outcome furthest behind its share of the visits, so that the visits
+  // follow the probabilities of the outcomes without sampling noise.
+  int64_t total_weight = 0, total_visits = 0;
+  for (Node *child = node->children;
+       child != node->children + node->num_children; ++child) {
+    total_weight += child->weight;
+    total_visits += child->visits.load(std::memory_order_relaxed);
+  }
+  Node *best = nullptr;
+  int64_t best_deficit = std::numeric_limits<int64_t>::min();
+  for (Node *child = node->children;
+       child != node->children + node->num_children; ++child) {
+    const int64_t deficit =
+        child->weight * (total_visits + 1) -
+        child->visits.load(std::memory_order_relaxed) * total_weight;
+    if (deficit > best_deficit) {
+      best_deficit = deficit;
+      best = child;
+    }
+  }
+  return best;
+}
+
+void Mcts::RunIteration(const ChessBoard &root_board, PlayoutRng *rng) {
+  ChessBoard board = root_board;
+  // The nodes below the root on the path, with the player who made the move
+  // into each.
+  FixedVector<std::pair<Node *, ChessColor>, kMaxPath> path;
+  Node *node = &root_;
+  node->visits.fetch_add(1, std::memory_order_relaxed);
+  // The reward of the leaf for the player to move on it.
+  float reward;
+  while (true) {
+    if (board.Terminate()) {
+      const ChessColor winner = board.GetWinner();
+      reward = winner == DRAW                        ? 0.5
+               : winner == board.GetCurrentPlayer() ? 1
+                                                    : 0;
+      break;
+    }
+    if (node->state.load(std::memory_order_acquire) != kExpanded) {
+      // A new decision node is scored as a leaf, while a chance node goes on
+      // to one of its outcomes.
+      if (path.size() == kMaxPath || !Expand(board, node) ||
+          (!node->IsChance() && node->num_children > 0)) {
+        reward = EvaluateLeaf(board, rng);
+        break;
+      }
+    }
+    if (node->num_children == 0) {
+      // The player to move can neither move nor flip.
+      reward = 0;
+      break;
+    }
+    Node *child = node->IsChance() ? SelectOutcome(node) : SelectChild(node);
+    child->visits.fetch_add(1, std::memory_order_relaxed);
+    path.push_back({child, board.GetCurrentPlayer()});
+    if (!child->IsChance()) board.MakeMove(child->move);
+    node = child;
+  }
+  const ChessColor player = board.GetCurrentPlayer();
+  for (const auto &[visited, mover] : path) {
+    const float r = mover == player ? reward : 1 - reward;
+    visited->rewards.fetch_add(static_cast<uint64_t>(r * kRewardScale),
+                               std::memory_order_relaxed);
+  }
+}
+
+void Mcts::Work(const ChessBoard &board, size_t id) {
+  PlayoutRng rng(id);
+  while (!done_.load(std::memory_order_relaxed) &&
+         !stop_.load(std::memory_order_relaxed)) {
+    RunIteration(board, &rng);
+    num_iterations_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+ChessMove Mcts::Search(const ChessBoard &board, size_t num_threads,
+                       const TimeManager &time_manager,
+                       uint64_t iteration_limit) {
+  assert(board.GetCurrentPlayer() != UNKNOWN);
+  arena_.Clear();
+  root_.Init(ChessMove(), 0);
+  if (board.Terminate() || !Expand(board, &root_) || root_.num_children == 0)
+    return ChessMove();
+  done_.store(false);
+  num_iterations_.store(0);
+
+  std::vector<std::thread> helpers;
+  for (size_t i = 1; i < num_threads; ++i)
+    helpers.emplace_back(&Mcts::Work, this, std::cref(board), i);
+  PlayoutRng rng(0);
+  for (uint64_t i = 1; !stop_.load(std::memory_order_relaxed); ++i) {
+    RunIteration(board, &rng);
+    const uint64_t n = num_iterations_.fetch_add(1) + 1;
+    if (iteration_limit > 0 ? n >= iteration_limit
+                            : i % kCheckInterval == 0 &&
+                                  time_manager.GetElapsed() >=
+                                      time_manager.GetSoftLimit()) {
+      break;
+    }
+  }
+  done_.store(true);
+  for (auto &helper : helpers) helper.join();
+
+  const Node *best = root_.children;
+  for (const Node *child = root_.children;
+       child != root_.children + root_.num_children; ++child) {
+    if (child->visits.load() > best->visits.load()) best = child;
+  }
+  std::cerr << "MCTS iterations = " << num_iterations_.load()
+            << " nodes = " << arena_.GetUsed() << "/" << arena_.GetCapacity()
+            << " value = " << best->GetValue()
+            << " visits = " << best->visits.load() << "\n";
+  return best->move;
+}
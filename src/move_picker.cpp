@@ -0,0 +1,87 @@
+#include "move_picker.h"
+
+#include <utility>
+
+MovePicker::MovePicker(const ChessBoard &board, ChessColor color,
+                       ChessMove tt_move, const KillerMoves &killers,
+                       const HistoryTable &history)
+    : board_(board),
+      color_(color),
+      tt_move_(board.Playable(tt_move) ? tt_move : ChessMove()),
+      killers_(killers),
+      history_(history),
+      stage_(TT_MOVE),
+      index_(0),
+      flips_(board.GetCoveredSquares()) {}
+
+bool MovePicker::IsKiller(ChessMove mv) const {
+  return mv == killers_[0] || mv == killers_[1];
+}
+
+ChessMove MovePicker::PickBest() {
+  size_t best = index_;
+  for (size_t i = index_ + 1; i < moves_.size(); ++i) {
+    if (scores_[i] > scores_[best]) best = i;
+  }
+  std::swap(moves_[index_], moves_[best]);
+  std::swap(scores_[index_], scores_[best]);
+  return moves_[index_++];
+}
+
+ChessMove MovePicker::Next() {
+  switch (stage_) {
+    case TT_MOVE:
+      stage_ = GENERATE_CAPTURES;
+      if (!tt_move_.IsNull()) return tt_move_;
+      [[fallthrough]];
+    case GENERATE_CAPTURES:
+      board_.ListCaptures(color_, &moves_);
+      for (size_t i = 0; i < moves_.size(); ++i)
+        scores_[i] = board_.GetCaptureScore(moves_[i]);
+      stage_ = CAPTURES;
+      [[fallthrough]];
+    case CAPTURES:
+      while (index_ < moves_.size()) {
+        ChessMove mv = PickBest();
+        if (mv != tt_move_) return mv;
+      }
+      stage_ = KILLERS;
+      index_ = 0;
+      [[fallthrough]];
+    case KILLERS:
+      while (index_ < killers_.size()) {
+        ChessMove mv = killers_[index_++];
+        if (mv.IsNull() || mv.IsFlip() || mv == tt_move_) continue;
+        if (board_.GetPiece(mv.GetDst()) != NO_PIECE) continue;
+        if (board_.Playable(mv)) return mv;
+      }
+      stage_ = GENERATE_QUIETS;
+      [[fallthrough]];
+    case GENERATE_QUIETS:
+      moves_.clear();
+      index_ = 0;
+      board_.ListQuiets(color_, &moves_);
+      for (size_t i = 0; i < moves_.size(); ++i)
+        scores_[i] = history_[moves_[i].GetSrc()][moves_[i].GetDst()];
+      stage_ = QUIETS;
+      [[fallthrough]];
+    case QUIETS:
+      while (index_ < moves_.size()) {
+        ChessMove mv = PickBest();
+        if (mv != tt_move_ && !IsKiller(mv)) return mv;
+      }
+      stage_ = FLIPS;
+      [[fallthrough]];
+    case FLIPS:
+      while (flips_ > 0) {
+        ChessMove mv = Flip(__builtin_ctz(flips_));
+        flips_ &= flips_ - 1;
+        if (mv != tt_move_) return mv;
+      }
+      stage_ = DONE;
+      [[fallthrough]];
+    case DONE:
+      break;
+  }
+  return ChessMove();
+}
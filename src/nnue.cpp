@@ -0,0 +1,313 @@
+#include "nnue.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+using Accumulator = Network::Accumulator;
+
+constexpr size_t kInputParamsSize =
+    Network::kHidden * sizeof(int16_t) * (1 + Network::kNumInputs);
+constexpr size_t kHidden1ParamsSize =
+    Network::kLayerSize * (sizeof(int32_t) + 2 * Network::kHidden);
+constexpr size_t kHidden2ParamsSize =
+    Network::kLayerSize * (sizeof(int32_t) + Network::kLayerSize);
+constexpr size_t kOutputParamsSize = sizeof(int32_t) + Network::kLayerSize;
+constexpr size_t kFileSize = Network::kHeaderSize + kInputParamsSize +
+                             kHidden1ParamsSize + kHidden2ParamsSize +
+                             kOutputParamsSize;
+
+// Points *section at the next count values of the mapping at *p.
+template <class T>
+void Take(const char **p, size_t count, const T **section) {
+  *section = reinterpret_cast<const T *>(*p);
+  *p += count * sizeof(T);
+}
+
+// The piece as seen from the view: colors are swapped for BLACK.
+ChessPiece GetViewPiece(ChessColor view, ChessPiece piece) {
+  if (view == RED || piece >= NO_PIECE) return piece;
+  return ChessPiece(piece < kNumChessPieces ? piece + kNumChessPieces
+                                            : piece - kNumChessPieces);
+}
+
+uint16_t GetSquareInput(ChessColor view, uint8_t pos, ChessPiece piece) {
+  const uint8_t square = view == RED ? pos : 31 - pos;
+  return square * 16 + GetViewPiece(view, piece);
+}
+
+// The input set while the pool holds at least count pieces of the kind.
+uint16_t GetCoveredInput(ChessColor view, ChessPiece kind, uint8_t count) {
+  return Network::kNumSquareInputs +
+         GetViewPiece(view, kind) * Network::kMaxCovered + count - 1;
+}
+
+// Adds the rows of weights of the added inputs to the accumulator of a view
+// and subtracts those of the removed ones.
+template <size_t kMaxRemoved, size_t kMaxAdded>
+void ApplyRows(const int16_t *before, const int16_t *weights,
+               const FixedVector<uint16_t, kMaxRemoved> &removed,
+               const FixedVector<uint16_t, kMaxAdded> &added, int16_t *after) {
+#ifdef __AVX2__
+  // The whole accumulator of a view stays in registers.
+  constexpr size_t kNumRegisters = Network::kHidden / 16;
+  __m256i sums[kNumRegisters];
+  for (size_t r = 0; r < kNumRegisters; ++r) {
+    sums[r] = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(before + r * 16));
+  }
+  for (uint16_t input : removed) {
+    const auto *row = reinterpret_cast<const __m256i *>(
+        weights + input * Network::kHidden);
+    for (size_t r = 0; r < kNumRegisters; ++r)
+      sums[r] = _mm256_sub_epi16(sums[r], _mm256_loadu_si256(row + r));
+  }
+  for (uint16_t input : added) {
+    const auto *row = reinterpret_cast<const __m256i *>(
+        weights + input * Network::kHidden);
+    for (size_t r = 0; r < kNumRegisters; ++r)
+      sums[r] = _mm256_add_epi16(sums[r], _mm256_loadu_si256(row + r));
+  }
+  for (size_t r = 0; r < kNumRegisters; ++r)
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(after + r * 16), sums[r]);
+#else
+  std::copy(before, before + Network::kHidden, after);
+  for (uint16_t input : removed) {
+    const int16_t *row = weights + input * Network::kHidden;
+    for (size_t i = 0; i < Network::kHidden; ++i) after[i] -= row[i];
+  }
+  for (uint16_t input : added) {
+    const int16_t *row = weights + input * Network::kHidden;
+    for (size_t i = 0; i < Network::kHidden; ++i) after[i] += row[i];
+  }
+#endif
+}
+
+// Computes out[j] = biases[j] + the sum over i of weights[j * n + i] * x[i]
+// for the m outputs, n being a multiple of 32.
+void Affine(const uint8_t *x, size_t n, const int8_t *weights,
+            const int32_t *biases, size_t m, int32_t *out) {
+#ifdef __AVX2__
+  const __m256i ones = _mm256_set1_epi16(1);
+  for (size_t j = 0; j < m; ++j) {
+    __m256i sum = _mm256_setzero_si256();
+    for (size_t i = 0; i < n; i += 32) {
+      const __m256i a =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + i));
+      const __m256i b = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(weights + j * n + i));
+      // The pairs of products fit in int16 since x <= 127.
+      sum = _mm256_add_epi32(
+          sum, _mm256_madd_epi16(_mm256_maddubs_epi16(a, b), ones));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum),
+                              _mm256_extracti128_si256(sum, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    out[j] = biases[j] + _mm_cvtsi128_si32(s);
+  }
+#else
+  for (size_t j = 0; j < m; ++j) {
+    int32_t sum = biases[j];
+    for (size_t i = 0; i < n; ++i) sum += weights[j * n + i] * x[i];
+    out[j] = sum;
+  }
+#endif
+}
+
+// Scales the outputs of a layer down to the inputs of the next, in [0, 127].
+void ClippedRelu(const int32_t *in, size_t n, uint8_t *out) {
+  for (size_t i = 0; i < n; ++i)
+    out[i] = std::clamp(in[i] >> Network::kWeightShift, 0, 127);
+}
+
+}  // namespace
+
+Network::Network()
+    : input_biases_(nullptr),
+      input_weights_(nullptr),
+      hidden1_biases_(nullptr),
+      hidden1_weights_(nullptr),
+      hidden2_biases_(nullptr),
+      hidden2_weights_(nullptr),
+      output_bias_(nullptr),
+      output_weights_(nullptr),
+      output_scale_(0),
+      mapping_(nullptr),
+      mapping_size_(0) {}
+
+Network::~Network() { Unload(); }
+
+void Network::Unload() {
+  if (mapping_) munmap(mapping_, mapping_size_);
+  mapping_ = nullptr;
+  mapping_size_ = 0;
+}
+
+bool Network::Load(const std::string &path) {
+  Unload();
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  void *addr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size == static_cast<off_t>(kFileSize))
+    addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) return false;
+  const auto *data = static_cast<const char *>(addr);
+
+  std::array<uint32_t, 3> sizes;
+  std::memcpy(sizes.data(), data + 4, sizeof(sizes));
+  if (std::memcmp(data, kMagic, sizeof(kMagic)) != 0 ||
+      sizes[0] != kNumInputs || sizes[1] != kHidden ||
+      sizes[2] != kLayerSize) {
+    munmap(addr, kFileSize);
+    return false;
+  }
+  std::memcpy(&output_scale_, data + 16, sizeof(output_scale_));
+  mapping_ = addr;
+  mapping_size_ = kFileSize;
+
+  // The sections are laid out back to back.
+  const char *p = data + kHeaderSize;
+  Take(&p, kHidden, &input_biases_);
+  Take(&p, kNumInputs * kHidden, &input_weights_);
+  Take(&p, kLayerSize, &hidden1_biases_);
+  Take(&p, kLayerSize * 2 * kHidden, &hidden1_weights_);
+  Take(&p, kLayerSize, &hidden2_biases_);
+  Take(&p, kLayerSize * kLayerSize, &hidden2_weights_);
+  Take(&p, 1, &output_bias_);
+  Take(&p, kLayerSize, &output_weights_);
+  assert(p == data + kFileSize);
+  return true;
+}
+
+void Network::GetChanges(const ChessBoard &before, const ChessBoard &after,
+                         Changes *changes) {
+  for (auto &inputs : changes->removed) inputs.clear();
+  for (auto &inputs : changes->added) inputs.clear();
+  for (uint32_t mask = after.GetChangedSquares(before); mask > 0;
+       mask &= mask - 1) {
+    const uint8_t pos = __builtin_ctz(mask);
+    for (ChessColor view : {RED, BLACK}) {
+      changes->removed[view].push_back(
+          GetSquareInput(view, pos, before.GetPiece(pos)));
+      changes->added[view].push_back(
+          GetSquareInput(view, pos, after.GetPiece(pos)));
+    }
+  }
+  const uint32_t covered = after.GetChangedCovered(before);
+  if (covered == 0) return;
+  const auto old_counts = before.GetCoveredPieces();
+  const auto new_counts = after.GetCoveredPieces();
+  for (uint32_t mask = covered; mask > 0; mask &= mask - 1) {
+    const auto kind = ChessPiece(__builtin_ctz(mask));
+    const uint8_t old_count = old_counts[kind], new_count = new_counts[kind];
+    for (uint8_t c = std::min(old_count, new_count) + 1;
+         c <= std::max(old_count, new_count); ++c) {
+      for (ChessColor view : {RED, BLACK}) {
+        (new_count < old_count ? changes->removed : changes->added)[view]
+            .push_back(GetCoveredInput(view, kind, c));
+      }
+    }
+  }
+}
+
+void Network::Refresh(const ChessBoard &board,
+                      Accumulator *accumulator) const {
+  const auto covered = board.GetCoveredPieces();
+  // A square input per square, and at most one covered input per piece.
+  const FixedVector<uint16_t, 0> none;
+  FixedVector<uint16_t, 64> inputs;
+  for (ChessColor view : {RED, BLACK}) {
+    inputs.clear();
+    for (uint8_t pos = 0; pos < 32; ++pos)
+      inputs.push_back(GetSquareInput(view, pos, board.GetPiece(pos)));
+    for (size_t kind = 0; kind < covered.size(); ++kind) {
+      for (uint8_t c = 1; c <= covered[kind]; ++c)
+        inputs.push_back(GetCoveredInput(view, ChessPiece(kind), c));
+    }
+    ApplyRows(input_biases_, input_weights_, none, inputs,
+              accumulator->values[view].data());
+  }
+}
+
+void Network::Update(const Accumulator &before, const Changes &changes,
+                     Accumulator *after) const {
+  for (ChessColor view : {RED, BLACK}) {
+    ApplyRows(before.values[view].data(), input_weights_,
+              changes.removed[view], changes.added[view],
+              after->values[view].data());
+  }
+}
+
+float Network::Evaluate(const Accumulator &accumulator,
+                        ChessColor color) const {
+  alignas(32) std::array<uint8_t, 2 * kHidden> input;
+  for (size_t half = 0; half < 2; ++half) {
+    const auto &values = accumulator.values[color ^ int(half)];
+    for (size_t i = 0; i < kHidden; ++i) {
+      input[half * kHidden + i] = std::clamp<int16_t>(values[i], 0, 127);
+    }
+  }
+  alignas(32) std::array<int32_t, kLayerSize> sums;
+  alignas(32) std::array<uint8_t, kLayerSize> hidden1, hidden2;
+  Affine(input.data(), input.size(), hidden1_weights_, hidden1_biases_,
+         kLayerSize, sums.data());
+  ClippedRelu(sums.data(), kLayerSize, hidden1.data());
+  Affine(hidden1.data(), kLayerSize, hidden2_weights_, hidden2_biases_,
+         kLayerSize, sums.data());
+  ClippedRelu(sums.data(), kLayerSize, hidden2.data());
+  int32_t output;
+  Affine(hidden2.data(), kLayerSize, output_weights_, output_bias_, 1,
+         &output);
+  return output * output_scale_;
+}
+
+float Network::Evaluate(const ChessBoard &board, ChessColor color) const {
+  Accumulator accumulator;
+  Refresh(board, &accumulator);
+  return Evaluate(accumulator, color);
+}
+
+AccumulatorStack::AccumulatorStack(const Network &network)
+    : network_(network), entries_(kMaxPly + 1), ply_(0) {}
+
+void AccumulatorStack::Reset(const ChessBoard &board) {
+  root_ = board;
+  ply_ = 0;
+  entries_[0].computed = false;
+}
+
+void AccumulatorStack::Push(const ChessBoard &before,
+                            const ChessBoard &after) {
+  assert(ply_ < kMaxPly);
+  Entry &entry = entries_[++ply_];
+  Network::GetChanges(before, after, &entry.changes);
+  entry.computed = false;
+}
+
+float AccumulatorStack::Evaluate(ChessColor color) {
+  size_t ply = ply_;
+  while (ply > 0 && !entries_[ply].computed) --ply;
+  if (!entries_[ply].computed) {
+    network_.Refresh(root_, &entries_[0].accumulator);
+    entries_[0].computed = true;
+  }
+  for (++ply; ply <= ply_; ++ply) {
+    network_.Update(entries_[ply - 1].accumulator, entries_[ply].changes,
+                    &entries_[ply].accumulator);
+    entries_[ply].computed = true;
+  }
+  return network_.Evaluate(entries_[ply_].accumulator, color);
+}
@@ -0,0 +1,182 @@
+// Counts the leaves of the game tree of each position read from stdin, in the
+// format of debug.cpp, to measure and validate move generation apart from the
+// search. A flip is expanded into every outcome, each weighted by the number
+// of covered pieces of its kind, so the count is that of the distinct games.
+// Positions where the game is over count as leaves.
+//
+// Usage: perft [--depth=N] [--threads=T] [--divide] < positions
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "chess.h"
+
+namespace {
+
+struct Counts {
+  uint64_t leaves = 0;
+  // The number of moves made, which the speed is measured in.
+  uint64_t nodes = 0;
+};
+
+// Made on copies of the board or undone, as in the search.
+#ifdef COPY_MAKE
+using Updater = BoardStack;
+#else
+class Updater {
+  ChessBoard board_;
+  BoardUpdater updater_{board_};
+
+ public:
+  ChessBoard &GetBoard() { return board_; }
+  void MakeMove(ChessMove mv) { updater_.MakeMove(mv); }
+  void Rewind() { updater_.Rewind(); }
+};
+#endif
+
+void Perft(Updater &updater, int depth, uint64_t weight, Counts *counts) {
+  const ChessBoard &board = updater.GetBoard();
+  if (depth == 0 || board.Terminate()) {
+    counts->leaves += weight;
+    return;
+  }
+  const ChessColor player = board.GetCurrentPlayer();
+  if (player != UNKNOWN) {
+    for (ChessMove mv : board.ListMoves(player)) {
+      updater.MakeMove(mv);
+      ++counts->nodes;
+      Perft(updater, depth - 1, weight, counts);
+      updater.Rewind();
+    }
+  }
+  const auto covered = board.GetCoveredPieces();
+  for (uint32_t mask = board.GetCoveredSquares(); mask > 0; mask &= mask - 1) {
+    for (size_t piece = 0; piece < covered.size(); ++piece) {
+      if (covered[piece] == 0) continue;
+      updater.MakeMove(Flip(__builtin_ctz(mask), ChessPiece(piece)));
+      ++counts->nodes;
+      Perft(updater, depth - 1, weight * covered[piece], counts);
+      updater.Rewind();
+    }
+  }
+}
+
+// A root move, with the outcome of a flip.
+struct RootUnit {
+  ChessMove mv;
+  uint64_t weight;
+  Counts counts;
+};
+
+void RunPosition(const ChessBoard &board, int depth, size_t num_threads,
+                 bool divide) {
+  std::vector<RootUnit> units;
+  if (depth > 0 && !board.Terminate()) {
+    if (board.GetCurrentPlayer() != UNKNOWN) {
+      for (ChessMove mv : board.ListMoves(board.GetCurrentPlayer()))
+        units.push_back({mv, 1, {}});
+    }
+    const auto covered = board.GetCoveredPieces();
+    for (uint32_t mask = board.GetCoveredSquares(); mask > 0;
+         mask &= mask - 1) {
+      for (size_t piece = 0; piece < covered.size(); ++piece) {
+        if (covered[piece] == 0) continue;
+        units.push_back({Flip(__builtin_ctz(mask), ChessPiece(piece)),
+                         covered[piece],
+                         {}});
+      }
+    }
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  Counts total;
+  if (units.empty()) {
+    total.leaves = 1;
+  } else {
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+      auto updater = std::make_unique<Updater>();
+      updater->GetBoard() = board;
+      for (size_t i; (i = next.fetch_add(1)) < units.size();) {
+        updater->MakeMove(units[i].mv);
+        units[i].counts.nodes = 1;
+        Perft(*updater, depth - 1, units[i].weight, &units[i].counts);
+        updater->Rewind();
+      }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min(num_threads, units.size()); ++i)
+      threads.emplace_back(work);
+    work();
+    for (auto &thread : threads) thread.join();
+  }
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+  // The outcomes of a flip are reported together.
+  for (size_t i = 0; i < units.size();) {
+    ChessMove mv = units[i].mv;
+    uint64_t leaves = 0;
+    for (; i < units.size() && units[i].mv.GetSrc() == mv.GetSrc() &&
+           units[i].mv.GetDst() == mv.GetDst();
+         ++i) {
+      leaves += units[i].counts.leaves;
+      total.leaves += units[i].counts.leaves;
+      total.nodes += units[i].counts.nodes;
+    }
+    if (divide) std::cout << mv << ": " << leaves << "\n";
+  }
+  std::cout << "depth = " << depth << " leaves = " << total.leaves
+            << " nodes = " << total.nodes << " time = " << seconds
+            << " s nodes/s = " << static_cast<uint64_t>(total.nodes / seconds)
+            << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  int depth = 3;
+  size_t num_threads = 1;
+  bool divide = false;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg.substr(0, 8) == "--depth=") {
+      depth = std::stoi(std::string(arg.substr(8)));
+    } else if (arg.substr(0, 10) == "--threads=") {
+      num_threads = std::max(1UL, std::stoul(std::string(arg.substr(10))));
+    } else if (arg == "--divide") {
+      divide = true;
+    } else {
+      std::cerr << "Unrecognized argument: " << arg << std::endl;
+      exit(1);
+    }
+  }
+
+  std::array<std::string, 8> buffer;
+  while (std::cin >> buffer[7]) {
+    for (int i = 6; i >= 0; --i) std::cin >> buffer[i];
+    std::array<uint8_t, kNumChessPieces * 2> covered;
+    for (auto &count : covered) {
+      int v;
+      std::cin >> v;
+      count = v;
+    }
+    std::string player;
+    std::cin >> player;
+    if (!std::cin) {
+      std::cerr << "Truncated position" << std::endl;
+      exit(1);
+    }
+    RunPosition(ChessBoard(buffer, covered, player == "RED" ? RED : BLACK),
+                depth, num_threads, divide);
+  }
+  return 0;
+}
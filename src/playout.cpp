@@ -0,0 +1,140 @@
+#include "playout.h"
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+#include "chess.h"
+
+namespace {
+
+// The square of the n-th set bit of mask, counting from 0.
+uint8_t GetNthSquare(uint32_t mask, uint32_t n) {
+#ifdef __BMI2__
+  return __builtin_ctz(_pdep_u32(1U << n, mask));
+#else
+  for (; n > 0; --n) mask &= mask - 1;
+  return __builtin_ctz(mask);
+#endif
+}
+
+}  // namespace
+
+PlayoutBoard::PlayoutBoard(const ChessBoard &board)
+    : pieces_{},
+      uncovered_(board.uncovered_squares_),
+      covered_squares_(board.covered_squares_),
+      covered_(board.GetCoveredPieces()),
+      num_covered_{board.GetNumCoveredPieces(RED),
+                   board.GetNumCoveredPieces(BLACK)},
+      no_flip_capture_count_(board.no_flip_capture_count_),
+      player_(board.current_player_),
+      ply_(0) {
+  for (uint8_t pos = 0; pos < squares_.size(); ++pos) {
+    squares_[pos] = board.GetPiece(pos);
+    if (squares_[pos] < NO_PIECE) pieces_[squares_[pos]] |= 1U << pos;
+  }
+}
+
+void PlayoutBoard::MakeFlip(uint8_t pos, PlayoutRng *rng) {
+  uint32_t r = rng->Below(num_covered_[RED] + num_covered_[BLACK]);
+  size_t piece = 0;
+  while (r >= covered_[piece]) r -= covered_[piece++];
+  const ChessPiece result = ChessPiece(piece);
+  const ChessColor color = GetChessPieceColor(result);
+  if (player_ == UNKNOWN) player_ = color;
+  squares_[pos] = result;
+  pieces_[result] |= 1U << pos;
+  uncovered_[color] |= 1U << pos;
+  covered_squares_ ^= 1U << pos;
+  --covered_[result];
+  --num_covered_[color];
+  no_flip_capture_count_ = 0;
+  player_ ^= 1;
+}
+
+void PlayoutBoard::MakeMove(uint8_t src, uint8_t dst) {
+  const ChessPiece piece = squares_[src], victim = squares_[dst];
+  if (victim != NO_PIECE) {
+    pieces_[victim] ^= 1U << dst;
+    uncovered_[player_ ^ 1] ^= 1U << dst;
+    no_flip_capture_count_ = 0;
+  } else {
+    ++no_flip_capture_count_;
+  }
+  squares_[dst] = piece;
+  squares_[src] = NO_PIECE;
+  pieces_[piece] ^= 1U << src | 1U << dst;
+  uncovered_[player_] ^= 1U << src | 1U << dst;
+  player_ ^= 1;
+}
+
+bool PlayoutBoard::MakeRandomMove(PlayoutRng *rng) {
+  const uint32_t num_flips = __builtin_popcount(covered_squares_);
+  if (player_ == UNKNOWN) {
+    if (num_flips == 0) return false;
+    MakeFlip(GetNthSquare(covered_squares_, rng->Below(num_flips)), rng);
+    return true;
+  }
+  const ChessColor opponent = player_ ^ 1;
+  const size_t own = player_ * kNumChessPieces;
+  const size_t opp = opponent * kNumChessPieces;
+  const uint32_t empty =
+      ~(covered_squares_ | uncovered_[RED] | uncovered_[BLACK]);
+
+  // The opponent's pieces each kind can capture by stepping: those of the
+  // same or a lower rank, except that soldiers capture generals and generals
+  // do not capture soldiers.
+  std::array<uint32_t, kNumChessPieces> victims;
+  uint32_t lower = 0;
+  for (size_t t = 0; t < kNumChessPieces; ++t)
+    victims[t] = lower |= pieces_[opp + t];
+  victims[SOLDIER] |= pieces_[opp + GENERAL];
+  victims[GENERAL] &= ~pieces_[opp + SOLDIER];
+
+  // The destinations of every piece that can move, at most 16.
+  std::array<uint32_t, 16> targets;
+  std::array<uint8_t, 16> sources;
+  size_t n = 0;
+  uint32_t total = num_flips;
+  for (size_t t = 0; t < kNumChessPieces; ++t) {
+    for (uint32_t mask = pieces_[own + t]; mask > 0; mask &= mask - 1) {
+      const uint8_t p = __builtin_ctz(mask);
+      uint32_t dst = ChessBoard::kNeighborMasks[p] & empty;
+      if (t == CANNON) {
+        dst |= ChessBoard::GetCannonTargets(p, ~empty) & uncovered_[opponent];
+      } else {
+        dst |= ChessBoard::kNeighborMasks[p] & victims[t];
+      }
+      if (dst == 0) continue;
+      targets[n] = dst;
+      sources[n++] = p;
+      total += __builtin_popcount(dst);
+    }
+  }
+  if (total == 0) return false;
+
+  uint32_t r = rng->Below(total);
+  if (r < num_flips) {
+    MakeFlip(GetNthSquare(covered_squares_, r), rng);
+    return true;
+  }
+  r -= num_flips;
+  size_t i = 0;
+  for (uint32_t count; r >= (count = __builtin_popcount(targets[i])); ++i)
+    r -= count;
+  MakeMove(sources[i], GetNthSquare(targets[i], r));
+  return true;
+}
+
+ChessColor PlayoutBoard::Playout(PlayoutRng *rng) {
+  while (true) {
+    // The same order of checks as ChessBoard::Terminate and GetWinner.
+    if (no_flip_capture_count_ == ChessBoard::GetNoFlipCaptureCountLimit())
+      return DRAW;
+    if (uncovered_[RED] == 0 && num_covered_[RED] == 0) return BLACK;
+    if (uncovered_[BLACK] == 0 && num_covered_[BLACK] == 0) return RED;
+    if (!MakeRandomMove(rng)) return player_ ^ 1;
+    ++ply_;
+  }
+}
@@ -0,0 +1,110 @@
+// Measures the speed of random playouts from each position read from stdin,
+// in the format of debug.cpp, and reports their outcomes.
+//
+// Usage: playoutbench [--playouts=N] [--threads=T] [--seed=S] < positions
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "chess.h"
+#include "playout.h"
+
+namespace {
+
+// One cache line per thread.
+struct alignas(64) Counts {
+  // Indexed by the winner: RED, BLACK or DRAW.
+  std::array<uint64_t, 3> results{};
+  uint64_t plies = 0;
+};
+
+void RunPosition(const ChessBoard &board, uint64_t num_playouts,
+                 size_t num_threads, uint64_t seed) {
+  std::vector<Counts> counts(num_threads);
+  std::atomic<uint64_t> next(0);
+  // Playouts are handed out in batches so that the counter stays cold.
+  constexpr uint64_t kBatch = 256;
+  auto work = [&](size_t id) {
+    PlayoutRng rng(seed + id);
+    Counts &c = counts[id];
+    for (uint64_t begin; (begin = next.fetch_add(kBatch)) < num_playouts;) {
+      const uint64_t end = std::min(begin + kBatch, num_playouts);
+      for (uint64_t i = begin; i < end; ++i) {
+        PlayoutBoard playout(board);
+        ++c.results[playout.Playout(&rng)];
+        c.plies += playout.GetPly();
+      }
+    }
+  };
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; ++i) threads.emplace_back(work, i);
+  work(0);
+  for (auto &thread : threads) thread.join();
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+  Counts total;
+  for (const Counts &c : counts) {
+    for (size_t i = 0; i < total.results.size(); ++i)
+      total.results[i] += c.results[i];
+    total.plies += c.plies;
+  }
+  const double n = num_playouts;
+  std::cout << "playouts = " << num_playouts << " red = "
+            << total.results[RED] / n << " black = " << total.results[BLACK] / n
+            << " draw = " << total.results[DRAW] / n
+            << " plies = " << total.plies / n << " time = " << seconds
+            << " s playouts/s = " << static_cast<uint64_t>(n / seconds)
+            << " per core = "
+            << static_cast<uint64_t>(n / seconds / num_threads) << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  uint64_t num_playouts = 100'000, seed = 1;
+  size_t num_threads = 1;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg.substr(0, 11) == "--playouts=") {
+      num_playouts = std::stoull(std::string(arg.substr(11)));
+    } else if (arg.substr(0, 10) == "--threads=") {
+      num_threads = std::max(1UL, std::stoul(std::string(arg.substr(10))));
+    } else if (arg.substr(0, 7) == "--seed=") {
+      seed = std::stoull(std::string(arg.substr(7)));
+    } else {
+      std::cerr << "Unrecognized argument: " << arg << std::endl;
+      exit(1);
+    }
+  }
+
+  std::array<std::string, 8> buffer;
+  while (std::cin >> buffer[7]) {
+    for (int i = 6; i >= 0; --i) std::cin >> buffer[i];
+    std::array<uint8_t, kNumChessPieces * 2> covered;
+    for (auto &count : covered) {
+      int v;
+      std::cin >> v;
+      count = v;
+    }
+    std::string player;
+    std::cin >> player;
+    if (!std::cin) {
+      std::cerr << "Truncated position" << std::endl;
+      exit(1);
+    }
+    RunPosition(ChessBoard(buffer, covered, player == "RED" ? RED : BLACK),
+                num_playouts, num_threads, seed);
+  }
+  return 0;
+}
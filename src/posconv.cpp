@@ -0,0 +1,76 @@
+// Converts positions between the text format of positions.h, which selfplay
+// writes with --positions, and position files, which it writes with --records
+// and tune reads with --records. Text read from stdin is appended to the
+// position file; with --text, the records of the position file are printed
+// as text instead.
+//
+// Usage: posconv FILE < positions
+//        posconv --text FILE > positions
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include "positions.h"
+
+namespace {
+
+int ToRecords(const std::string &path) {
+  PositionWriter writer;
+  if (!writer.Open(path)) {
+    std::cerr << "Cannot open position file " << path << std::endl;
+    return 1;
+  }
+  uint64_t num_positions = 0, num_malformed = 0;
+  for (std::string line; std::getline(std::cin, line);) {
+    if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+    std::istringstream line_stream(line);
+    LabeledPosition position;
+    if (!ReadPosition(line_stream, &position)) {
+      ++num_malformed;
+      continue;
+    }
+    writer.Write(PositionRecord(position));
+    ++num_positions;
+  }
+  if (!writer.Flush()) {
+    std::cerr << "Cannot write position file " << path << std::endl;
+    return 1;
+  }
+  std::cerr << "positions = " << num_positions
+            << " malformed = " << num_malformed << std::endl;
+  return 0;
+}
+
+int ToText(const std::string &path) {
+  PositionFile file;
+  if (!file.Load(path)) {
+    std::cerr << "Cannot load position file " << path << std::endl;
+    return 1;
+  }
+  uint64_t num_malformed = 0;
+  LabeledPosition position;
+  for (const PositionRecord &record : file) {
+    if (!record.GetPosition(&position)) {
+      ++num_malformed;
+      continue;
+    }
+    std::cout << position << "\n";
+  }
+  std::cerr << "positions = " << file.GetSize() - num_malformed
+            << " malformed = " << num_malformed << std::endl;
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc == 2 && std::string_view(argv[1]).substr(0, 2) != "--")
+    return ToRecords(argv[1]);
+  if (argc == 3 && std::string_view(argv[1]) == "--text")
+    return ToText(argv[2]);
+  std::cerr << "Usage: posconv FILE < positions\n"
+            << "       posconv --text FILE > positions" << std::endl;
+  return 1;
+}
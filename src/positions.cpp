@@ -0,0 +1,205 @@
+#include "positions.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string>
+
+namespace {
+
+const char *GetColorName(ChessColor color) {
+  return color == RED ? "RED" : color == BLACK ? "BLACK" : "DRAW";
+}
+
+bool ParseColor(const std::string &name, ChessColor *color) {
+  if (name == "RED") {
+    *color = RED;
+  } else if (name == "BLACK") {
+    *color = BLACK;
+  } else if (name == "DRAW") {
+    *color = DRAW;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+constexpr uint32_t kRecordSize = sizeof(PositionRecord);
+
+// The number of pieces of each kind of a color.
+constexpr std::array<uint8_t, kNumChessPieces> kNumPieces = {5, 2, 2, 2,
+                                                             2, 2, 1};
+
+// Whether the covered pieces can be those of a game: no kind has more of them
+// than it has pieces, and they fill exactly the covered squares.
+bool CheckCovered(const std::array<uint8_t, kNumChessPieces * 2> &covered,
+                  int num_covered_squares) {
+  int total = 0;
+  for (size_t i = 0; i < covered.size(); ++i) {
+    if (covered[i] > kNumPieces[i % kNumChessPieces]) return false;
+    total += covered[i];
+  }
+  return total == num_covered_squares;
+}
+
+// Whether the header of a position file is valid.
+bool CheckHeader(const char *header) {
+  uint32_t record_size;
+  std::memcpy(&record_size, header + 4, sizeof(record_size));
+  return std::memcmp(header, PositionWriter::kMagic,
+                     sizeof(PositionWriter::kMagic)) == 0 &&
+         record_size == kRecordSize;
+}
+
+}  // namespace
+
+std::ostream &operator<<(std::ostream &os, const LabeledPosition &position) {
+  const ChessBoard &board = position.board;
+  for (int i = 7; i >= 0; --i) {
+    for (int j = 0; j < 4; ++j)
+      os << ChessBoard::GetPieceChar(board.GetPiece(i * 4 + j));
+    os << " ";
+  }
+  for (uint8_t c : board.GetCoveredPieces()) os << int(c) << " ";
+  return os << GetColorName(board.GetCurrentPlayer()) << " "
+            << board.GetNoFlipCaptureCount() << " "
+            << GetColorName(position.winner);
+}
+
+bool ReadPosition(std::istream &is, LabeledPosition *position) {
+  std::array<std::string, 8> buffer;
+  for (int i = 7; i >= 0; --i) is >> buffer[i];
+  std::array<uint8_t, kNumChessPieces * 2> covered;
+  bool counts_in_range = true;
+  for (auto &count : covered) {
+    int v;
+    is >> v;
+    if (v < 0 || v > 255) counts_in_range = false;
+    count = v;
+  }
+  std::string player, winner;
+  int count;
+  is >> player >> count >> winner;
+  if (!is) return false;
+  int num_covered_squares = 0;
+  for (const auto &row : buffer) {
+    if (row.size() != 4) return false;
+    num_covered_squares += std::count(
+        row.begin(), row.end(), ChessBoard::GetPieceChar(COVERED_PIECE));
+  }
+  if (!counts_in_range || !CheckCovered(covered, num_covered_squares))
+    return false;
+  ChessColor color;
+  if (!ParseColor(player, &color) || color == DRAW) return false;
+  if (!ParseColor(winner, &position->winner)) return false;
+  if (count < 0 || count > int(ChessBoard::GetNoFlipCaptureCountLimit()))
+    return false;
+  position->board = ChessBoard(buffer, covered, color, count);
+  return true;
+}
+
+PositionRecord::PositionRecord(const LabeledPosition &position, float score)
+    : squares{},
+      covered{},
+      player(position.board.GetCurrentPlayer()),
+      no_flip_capture_count(position.board.GetNoFlipCaptureCount()),
+      winner(position.winner),
+      padding{},
+      score(score) {
+  for (uint8_t pos = 0; pos < 32; ++pos)
+    squares[pos / 2] |= position.board.GetPiece(pos) << (pos % 2 * 4);
+  const auto counts = position.board.GetCoveredPieces();
+  for (size_t i = 0; i < counts.size(); ++i)
+    covered[i / 2] |= counts[i] << (i % 2 * 4);
+}
+
+bool PositionRecord::GetPosition(LabeledPosition *position) const {
+  if (player != RED && player != BLACK) return false;
+  if (winner != RED && winner != BLACK && winner != DRAW) return false;
+  if (no_flip_capture_count > ChessBoard::GetNoFlipCaptureCountLimit())
+    return false;
+  std::array<ChessPiece, 32> pieces;
+  int num_covered_squares = 0;
+  for (uint8_t pos = 0; pos < 32; ++pos) {
+    pieces[pos] = ChessPiece(squares[pos / 2] >> (pos % 2 * 4) & 15);
+    num_covered_squares += pieces[pos] == COVERED_PIECE;
+  }
+  std::array<uint8_t, kNumChessPieces * 2> counts;
+  for (size_t i = 0; i < counts.size(); ++i)
+    counts[i] = covered[i / 2] >> (i % 2 * 4) & 15;
+  if (!CheckCovered(counts, num_covered_squares)) return false;
+  position->board = ChessBoard(pieces, counts, player, no_flip_capture_count);
+  position->winner = winner;
+  return true;
+}
+
+bool PositionWriter::Open(const std::string &path) {
+  out_.close();
+  struct stat st;
+  const bool is_new = stat(path.c_str(), &st) != 0 || st.st_size == 0;
+  if (!is_new) {
+    std::array<char, kHeaderSize> header;
+    std::ifstream in(path, std::ios::binary);
+    if (!in.read(header.data(), header.size()) || !CheckHeader(header.data()))
+      return false;
+    // A partial record left by an interrupted writer would shift all those
+    // appended after it.
+    if ((st.st_size - kHeaderSize) % kRecordSize != 0) return false;
+  }
+  out_.open(path, std::ios::binary | std::ios::app);
+  if (!out_) return false;
+  if (is_new) {
+    std::array<char, kHeaderSize> header{};
+    std::memcpy(header.data(), kMagic, sizeof(kMagic));
+    std::memcpy(header.data() + 4, &kRecordSize, sizeof(kRecordSize));
+    out_.write(header.data(), header.size());
+  }
+  return static_cast<bool>(out_);
+}
+
+PositionFile::PositionFile()
+    : records_(nullptr), num_records_(0), mapping_(nullptr), mapping_size_(0) {}
+
+PositionFile::~PositionFile() { Unload(); }
+
+void PositionFile::Unload() {
+  if (mapping_) munmap(mapping_, mapping_size_);
+  records_ = nullptr;
+  num_records_ = 0;
+  mapping_ = nullptr;
+  mapping_size_ = 0;
+}
+
+bool PositionFile::Load(const std::string &path) {
+  Unload();
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  void *addr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 &&
+      st.st_size >= static_cast<off_t>(PositionWriter::kHeaderSize)) {
+    addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (addr == MAP_FAILED) return false;
+  const size_t size = st.st_size;
+  const auto *data = static_cast<const char *>(addr);
+  if (!CheckHeader(data) ||
+      (size - PositionWriter::kHeaderSize) % kRecordSize != 0) {
+    munmap(addr, size);
+    return false;
+  }
+  // The records are read once, front to back, by most tools.
+  madvise(addr, size, MADV_SEQUENTIAL);
+  mapping_ = addr;
+  mapping_size_ = size;
+  records_ = reinterpret_cast<const PositionRecord *>(
+      data + PositionWriter::kHeaderSize);
+  num_records_ = (size - PositionWriter::kHeaderSize) / kRecordSize;
+  return true;
+}
@@ -0,0 +1,645 @@
+#include "searcher.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+
+#include "chess.h"
+
+SearchStats &SearchStats::operator+=(const SearchStats &other) {
+  nodes += other.nodes;
+  chance_nodes += other.chance_nodes;
+  tt_probes += other.tt_probes;
+  tt_hits += other.tt_hits;
+  tt_cutoffs += other.tt_cutoffs;
+  beta_cutoffs += other.beta_cutoffs;
+  first_move_cutoffs += other.first_move_cutoffs;
+  scout_researches += other.scout_researches;
+  quiescence_nodes += other.quiescence_nodes;
+  delta_prunes += other.delta_prunes;
+  see_prunes += other.see_prunes;
+  aspiration_researches += other.aspiration_researches;
+  repetitions += other.repetitions;
+  null_move_cutoffs += other.null_move_cutoffs;
+  reductions += other.reductions;
+  futility_prunes += other.futility_prunes;
+  return *this;
+}
+
+Searcher::Searcher(TranspositionTable<ChessMove> &table,
+                   const Tablebase &tablebase, const std::atomic<bool> &stop)
+    : table_(table),
+      tablebase_(tablebase),
+      stop_(stop),
+      color_(UNKNOWN),
+      search_cut_(false),
+      completed_depth_(0),
+      completed_score_(0),
+      num_nodes_(0),
+      node_limit_(0),
+      killers_{},
+      history_{},
+      game_plies_(0),
+      network_(nullptr),
+      use_network_(false),
+      null_move_ply_(kNoNullMove),
+      pool_(nullptr),
+      queue_(0),
+      workers_(nullptr) {}
+
+void Searcher::SetTaskPool(
+    TaskPool *pool, size_t queue,
+    const std::vector<std::unique_ptr<Searcher>> *workers) {
+  pool_ = pool;
+  queue_ = queue;
+  workers_ = workers;
+}
+
+void Searcher::SetNetwork(const Network *network) {
+  network_ = network;
+  if (network_ != nullptr && !accumulators_)
+    accumulators_ = std::make_unique<AccumulatorStack>(*network_);
+}
+
+void Searcher::MakeMove(ChessMove mv) {
+  if (!use_network_) {
+    updater_.MakeMove(mv);
+    return;
+  }
+  const ChessBoard before = GetBoard();
+  updater_.MakeMove(mv);
+  accumulators_->Push(before, GetBoard());
+}
+
+void Searcher::MakeNullMove() {
+  updater_.MakeNullMove();
+  if (use_network_) accumulators_->Push(GetBoard(), GetBoard());
+}
+
+void Searcher::Rewind() {
+  updater_.Rewind();
+  if (use_network_) accumulators_->Pop();
+}
+
+float Searcher::Evaluate(ChessColor color) {
+  return use_network_ ? accumulators_->Evaluate(color)
+                      : GetBoard().Evaluate(color);
+}
+
+void Searcher::NewSearch(const ChessBoard &board, ChessColor color,
+                         const std::vector<HashKey> &history) {
+  assert(updater_.GetPly() == 0);
+  GetBoard() = board;
+  use_network_ = network_ != nullptr && network_->IsLoaded();
+  if (use_network_) accumulators_->Reset(board);
+  // The counter bounds how far back a repetition can be.
+  game_plies_ = std::min<size_t>(
+      {history.size(), board.GetNoFlipCaptureCount(), kMaxKeys / 2});
+  std::copy(history.end() - game_plies_, history.end(), keys_.begin());
+  color_ = color;
+  best_move_ = ChessMove();
+  completed_depth_ = 0;
+  completed_score_ = 0;
+  completed_move_ = ChessMove();
+  stats_ = {};
+  num_nodes_ = 0;
+  search_cut_ = false;
+  null_move_ply_ = kNoNullMove;
+  killers_ = {};
+  for (auto &row : history_) {
+    for (auto &v : row) v >>= 1;
+  }
+}
+
+// The outcomes of a set of flips, each claimed by exactly one thread.
+class ChanceJob : public TaskPool::Job {
+  Searcher &owner_;
+  const ChessBoard board_;
+  int depth_;
+  ChessColor color_;
+  std::atomic<size_t> next_;
+  std::atomic<bool> cut_;
+
+ public:
+  static constexpr size_t kMaxUnits = Searcher::kMaxFlips * kNumChessPieces * 2;
+
+  FixedVector<ChessMove, kMaxUnits> units;
+  // The window each outcome is searched with. An outcome with an empty window
+  // is not searched; its result is set beforehand.
+  std::array<float, kMaxUnits> alphas, betas;
+  std::array<float, kMaxUnits> results;
+
+  ChanceJob(Searcher &owner, const ChessBoard &board, int depth,
+            ChessColor color)
+      : owner_(owner),
+        board_(board),
+        depth_(depth),
+        color_(color),
+        next_(0),
+        cut_(false) {}
+
+  size_t Claim() { return next_.fetch_add(1, std::memory_order_relaxed); }
+  bool IsCut() const { return cut_.load(std::memory_order_relaxed); }
+
+  bool HasWork() const override {
+    return next_.load(std::memory_order_relaxed) < units.size();
+  }
+
+  bool RunOne(size_t worker) override {
+    size_t i = Claim();
+    if (i >= units.size()) return false;
+    if (alphas[i] >= betas[i]) return true;
+    bool cut = false;
+    results[i] = (*owner_.workers_)[worker]->SearchChild(
+        board_, units[i], alphas[i], betas[i], depth_, color_, &cut);
+    if (cut) cut_.store(true, std::memory_order_relaxed);
+    return true;
+  }
+};
+
+float Searcher::SearchChild(const ChessBoard &board, ChessMove mv, float alpha,
+                            float beta, int depth, ChessColor color,
+                            bool *cut) {
+  assert(updater_.GetPly() == 0);
+  GetBoard() = board;
+  use_network_ = network_ != nullptr && network_->IsLoaded();
+  if (use_network_) accumulators_->Reset(board);
+  search_cut_ = false;
+  // mv is a flip, so no repetition reaches back into the game.
+  game_plies_ = 0;
+  null_move_ply_ = kNoNullMove;
+  MakeMove(mv);
+  table_.Prefetch(GetBoard().GetHashValue());
+  float t = -NegaScout(-beta, -alpha, depth - 1, color ^ 1, false);
+  Rewind();
+  *cut = search_cut_;
+  return t;
+}
+
+void Searcher::ParallelChanceSearch(
+    float alpha, float beta, int depth, ChessColor color,
+    const FixedVector<ChessMove, kMaxFlips> &flips, const float *lower,
+    const float *upper, float *values) {
+  const auto covered = GetBoard().GetCoveredPieces();
+  int total = 0;
+  for (uint8_t count : covered) total += count;
+  ChanceJob job(*this, GetBoard(), depth, color);
+  // Star1, with the other outcomes of the flip at their bounds since they are
+  // searched at the same time: an outcome below its alpha bounds the
+  // expectation of the flip to at most alpha, and above its beta to at least
+  // beta, so the values of a flip add up to an exact value or a bound of the
+  // right side of the window.
+  std::array<float, ChanceJob::kMaxUnits> lo, hi;
+  for (ChessMove flip : flips) {
+    const size_t first = job.units.size();
+    float lower_sum = 0, upper_sum = 0;
+    for (uint8_t i = 0; i < covered.size(); ++i) {
+      if (covered[i] == 0) continue;
+      const size_t u = job.units.size();
+      lo[u] = lower != nullptr ? lower[u] : -kWinScore * (depth + 1);
+      hi[u] = upper != nullptr ? upper[u] : kWinScore * (depth + 1);
+      lower_sum += covered[i] * lo[u];
+      upper_sum += covered[i] * hi[u];
+      job.units.push_back(Flip(flip.GetPos(), ChessPiece(i)));
+    }
+    for (size_t u = first; u < job.units.size(); ++u) {
+      const float w = covered[job.units[u].GetResult()];
+      const float a = (alpha * total - upper_sum + w * hi[u]) / w;
+      const float b = (beta * total - lower_sum + w * lo[u]) / w;
+      job.alphas[u] = std::max(a, lo[u]);
+      job.betas[u] = std::min(b, hi[u]);
+      if (job.alphas[u] >= job.betas[u])
+        job.results[u] = hi[u] <= a ? hi[u] : lo[u];
+    }
+  }
+  pool_->Push(queue_, &job);
+  for (size_t i = job.Claim(); i < job.units.size(); i = job.Claim()) {
+    if (job.alphas[i] >= job.betas[i]) continue;
+    MakeMove(job.units[i]);
+    table_.Prefetch(GetBoard().GetHashValue());
+    job.results[i] = -NegaScout(-job.betas[i], -job.alphas[i], depth - 1,
+                                color ^ 1, false);
+    Rewind();
+  }
+  pool_->Remove(queue_, &job);
+  if (job.IsCut()) search_cut_ = true;
+
+  for (size_t f = 0, u = 0; f < flips.size(); ++f) {
+    float sum = 0;
+    for (uint8_t i = 0; i < covered.size(); ++i) {
+      if (covered[i] == 0) continue;
+      // Clamped to the bounds of the outcome as in ChanceNodeSearch.
+      sum += covered[i] * std::clamp(job.results[u], lo[u], hi[u]);
+      ++u;
+    }
+    values[f] = sum / total;
+  }
+}
+
+void Searcher::ProbeOutcomes(
+    uint8_t pos, int depth,
+    const FixedVector<ChessPiece, kMaxOutcomes> &outcomes, float *lower,
+    float *upper) {
+  for (size_t k = 0; k < outcomes.size(); ++k) {
+    MakeMove(Flip(pos, outcomes[k]));
+    Entry<ChessMove> entry;
+    if (table_.Probe(GetBoard().GetHashValue(), &entry) &&
+        entry.depth >= depth - 1) {
+      // The entry is scored for the opponent.
+      const float v = -entry.score;
+      switch (entry.GetFlag()) {
+        case EXACT_VALUE:
+          lower[k] = upper[k] = v;
+          break;
+        case LOWER_BOUND:
+          upper[k] = std::max(std::min(upper[k], v), lower[k]);
+          break;
+        case UPPER_BOUND:
+          lower[k] = std::min(std::max(lower[k], v), upper[k]);
+          break;
+        default:
+          break;
+      }
+    }
+    Rewind();
+  }
+}
+
+float Searcher::ChanceNodeSearch(float alpha, float beta, int depth,
+                                 ChessColor color, uint8_t pos) {
+  Count(&SearchStats::chance_nodes);
+  const auto covered = GetBoard().GetCoveredPieces();
+  FixedVector<ChessPiece, kMaxOutcomes> outcomes;
+  std::array<float, kMaxOutcomes> lower, upper;
+  int total = 0;
+  for (uint8_t i = 0; i < covered.size(); ++i) {
+    if (covered[i] > 0) {
+      lower[outcomes.size()] = -kWinScore * (depth + 1);
+      upper[outcomes.size()] = kWinScore * (depth + 1);
+      outcomes.push_back(ChessPiece(i));
+      total += covered[i];
+    }
+  }
+  // Star2: tighten the bounds of the outcomes from the transposition table and
+  // stop if they already decide the node. All the sums below are weighted by
+  // the number of covered pieces, i.e. scaled by total.
+  ProbeOutcomes(pos, depth, outcomes, lower.data(), upper.data());
+  float lower_rest = 0, upper_rest = 0;
+  for (size_t k = 0; k < outcomes.size(); ++k) {
+    lower_rest += covered[outcomes[k]] * lower[k];
+    upper_rest += covered[outcomes[k]] * upper[k];
+  }
+  if (upper_rest <= alpha * total) return upper_rest / total;
+  if (lower_rest >= beta * total) return lower_rest / total;
+
+  if (pool_ != nullptr && depth >= kParallelDepth) {
+    FixedVector<ChessMove, kMaxFlips> flips;
+    flips.push_back(Flip(pos));
+    float value;
+    ParallelChanceSearch(alpha, beta, depth, color, flips, lower.data(),
+                         upper.data(), &value);
+    return search_cut_ ? -kInf : value;
+  }
+
+  // Star1: search every outcome with the window outside of which the
+  // expectation is bound to leave (alpha, beta) whatever the outcomes left.
+  float sum = 0;
+  for (size_t k = 0; k < outcomes.size(); ++k) {
+    const float w = covered[outcomes[k]];
+    lower_rest -= w * lower[k];
+    upper_rest -= w * upper[k];
+    const float a = (alpha * total - sum - upper_rest) / w;
+    const float b = (beta * total - sum - lower_rest) / w;
+    if (lower[k] >= b) return (sum + w * lower[k] + lower_rest) / total;
+    if (upper[k] <= a) return (sum + w * upper[k] + upper_rest) / total;
+    float v = lower[k];
+    if (lower[k] != upper[k]) {
+      MakeMove(Flip(pos, outcomes[k]));
+      table_.Prefetch(GetBoard().GetHashValue());
+      v = -NegaScout(-std::min(b, upper[k]), -std::max(a, lower[k]),
+                     depth - 1, color ^ 1, false);
+      Rewind();
+      if (search_cut_) return -kInf;
+      // The bounds are proven, so a fail-soft value beyond one of them means
+      // the score is that bound.
+      v = std::clamp(v, lower[k], upper[k]);
+    }
+    sum += w * v;
+    if (v >= b) return (sum + lower_rest) / total;
+    if (v <= a) return (sum + upper_rest) / total;
+  }
+  return sum / total;
+}
+
+void Searcher::UpdateQuietStats(ChessMove mv, size_t ply, int depth) {
+  if (ply < kMaxPly && killers_[ply][0] != mv) {
+    killers_[ply][1] = killers_[ply][0];
+    killers_[ply][0] = mv;
+  }
+  history_[mv.GetSrc()][mv.GetDst()] += depth * depth;
+}
+
+float Searcher::Quiescence(float alpha, float beta, ChessColor color,
+                           int qply) {
+  if (search_cut_ || stop_.load(std::memory_order_relaxed)) {
+    search_cut_ = true;
+    return -kInf;
+  }
+  if (qply > 0) Count(&SearchStats::quiescence_nodes);
+  const ChessBoard &board = GetBoard();
+  if (board.Terminate()) {
+    const ChessColor winner = board.GetWinner();
+    if (winner == DRAW) return 0;
+    return winner == color ? kWinScore : -kWinScore;
+  }
+  const float stand_pat = Evaluate(color);
+  if (stand_pat >= beta || qply >= kMaxQuiescencePly) return stand_pat;
+  alpha = std::max(alpha, stand_pat);
+
+  MoveList captures;
+  board.ListCaptures(color, &captures);
+  std::sort(captures.begin(), captures.end(), [&](ChessMove x, ChessMove y) {
+    return board.GetCaptureScore(x) > board.GetCaptureScore(y);
+  });
+  float score = stand_pat;
+  for (ChessMove mv : captures) {
+    if (stand_pat + board.GetPieceValue(board.GetPiece(mv.GetDst())) +
+            kDeltaMargin <=
+        alpha) {
+      Count(&SearchStats::delta_prunes);
+      continue;
+    }
+    if (board.StaticExchange(mv) < 0) {
+      Count(&SearchStats::see_prunes);
+      continue;
+    }
+    MakeMove(mv);
+    const float t = -Quiescence(-beta, -alpha, color ^ 1, qply + 1);
+    Rewind();
+    if (t > score) {
+      score = t;
+      if (score >= beta) return score;
+      alpha = std::max(alpha, score);
+    }
+  }
+  return score;
+}
+
+bool Searcher::IsRepetition(size_t ply) {
+  const size_t index = game_plies_ + ply;
+  if (index >= kMaxKeys) return false;
+  const HashKey key = GetBoard().GetPositionKey();
+  keys_[index] = key;
+  // Only the positions since the last flip or capture, and after the last
+  // null move of the line, can be repeated.
+  size_t reach = std::min<size_t>(GetBoard().GetNoFlipCaptureCount(), index);
+  if (null_move_ply_ <= ply) reach = std::min(reach, ply - null_move_ply_);
+  // The player to move is part of the key, so only every other ply can match,
+  // and the first possible repetition is four plies back.
+  for (size_t back = 4; back <= reach; back += 2) {
+    if (keys_[index - back] == key) return true;
+  }
+  return false;
+}
+
+float Searcher::NegaScout(float alpha, float beta, int depth,
+                          ChessColor color, bool save_move) {
+  if (search_cut_ || stop_.load(std::memory_order_relaxed) ||
+      (node_limit_ > 0 && ++num_nodes_ > node_limit_)) {
+    search_cut_ = true;
+    return -kInf;
+  }
+  Count(&SearchStats::nodes);
+  const size_t ply = updater_.GetPly();
+  // A repeated position is scored as a draw: if neither player deviates, the
+  // cycle runs into the no-flip/capture rule.
+  if (IsRepetition(ply) && !save_move) {
+    Count(&SearchStats::repetitions);
+    return 0;
+  }
+  if (!save_move && GetBoard().GetCoveredSquares() == 0) {
+    uint8_t value;
+    if (tablebase_.Probe(GetBoard(), color, &value)) {
+      if (value == Tablebase::kDraw) return 0;
+      // Only trust results reached before the no-flip/capture rule applies.
+      if (value < ChessBoard::GetNoFlipCaptureCountLimit() -
+                      GetBoard().GetNoFlipCaptureCount()) {
+        // Score as the terminal node value plies away, or just below the
+        // shallowest win if that is beyond the horizon.
+        float score = value <= depth ? kWinScore * (depth - value + 1)
+                                     : kWinScore - value;
+        return value % 2 ? score : -score;
+      }
+    }
+  }
+  if (depth == 0) {
+    return features_.quiescence ? Quiescence(alpha, beta, color, 0)
+                                : Evaluate(color);
+  }
+  if (GetBoard().Terminate()) {
+    ChessColor winner = GetBoard().GetWinner();
+    if (winner == DRAW) return 0;
+    return (winner == color ? kWinScore : -kWinScore) * (depth + 1);
+  }
+  float score = -kInf;  // fail soft
+  const HashKey hv = GetBoard().GetHashValue();
+  Entry<ChessMove> entry;
+  ChessMove tt_move;
+  Count(&SearchStats::tt_probes);
+  if (table_.Probe(hv, &entry) && GetBoard().Playable(entry.best_move)) {
+    Count(&SearchStats::tt_hits);
+    tt_move = entry.best_move;
+    const Status flag = entry.GetFlag();
+    if (entry.depth < depth) {
+      if (flag == EXACT_VALUE) {
+        score = entry.score;
+        if (save_move) best_move_ = entry.best_move;
+      }
+    } else {
+      if (flag == EXACT_VALUE) {
+        Count(&SearchStats::tt_cutoffs);
+        if (save_move) best_move_ = entry.best_move;
+        return entry.score;
+      }
+      if (flag == LOWER_BOUND) {
+        if (entry.score >= beta) {
+          Count(&SearchStats::tt_cutoffs);
+          if (save_move) best_move_ = entry.best_move;
+          return entry.score;
+        }
+        alpha = std::max(alpha, entry.score);
+      } else {
+        if (entry.score <= alpha) {
+          Count(&SearchStats::tt_cutoffs);
+          if (save_move) best_move_ = entry.best_move;
+          return entry.score;
+        }
+        beta = std::min(beta, entry.score);
+      }
+    }
+  }
+  // Quiet moves near the no-flip/capture draw decide whether it happens, so
+  // the search is only selective away from it. Pruning also needs a bound
+  // away from a win, which must stay exact.
+  const bool selective =
+      !save_move && GetBoard().GetNoFlipCaptureCount() + depth <
+                        ChessBoard::GetNoFlipCaptureCountLimit();
+  const bool try_null_move =
+      selective && features_.null_move && depth >= kNullMoveMinDepth &&
+      ply != null_move_ply_ && std::abs(beta) < kWinScore;
+  const bool try_futility = selective && features_.futility &&
+                            depth < static_cast<int>(kFutilityMargins.size()) &&
+                            std::abs(alpha) < kWinScore;
+  const float static_eval =
+      try_null_move || try_futility ? Evaluate(color) : 0;
+  if (try_null_move && static_eval >= beta &&
+      __builtin_popcount(GetBoard().GetUncoveredSquares(color)) >= 2 &&
+      !(GetBoard().MarkUnderAttack() & GetBoard().GetUncoveredSquares(color))) {
+    // Passing is rarely the best move, so if the opponent cannot punish a
+    // pass even at a reduced depth, the node fails high.
+    const size_t saved_null_move_ply = null_move_ply_;
+    null_move_ply_ = ply + 1;
+    MakeNullMove();
+    const float t = -NegaScout(-beta, -beta + 1,
+                               depth - 1 - kNullMoveReduction, color ^ 1,
+                               false);
+    Rewind();
+    null_move_ply_ = saved_null_move_ply;
+    if (search_cut_) return -kInf;
+    if (t >= beta) {
+      Count(&SearchStats::null_move_cutoffs);
+      // A win found after a pass is not a proven one.
+      return t >= kWinScore ? beta : t;
+    }
+  }
+  // Quiet moves cannot lift a hopeless frontier node above alpha.
+  const bool futile =
+      try_futility && static_eval + kFutilityMargins[depth] <= alpha;
+
+  ChessMove opt;
+  MovePicker picker(GetBoard(), color, tt_move,
+                    killers_[std::min(ply, kMaxPly - 1)], history_);
+  size_t num_moves = 0;
+
+  float upper_bound = beta;
+  for (ChessMove v = picker.Next(); !v.IsNull(); v = picker.Next()) {
+    ++num_moves;
+    if (v.IsFlip() && pool_ != nullptr && depth >= kParallelDepth &&
+        picker.InFlipStage()) {
+      // Only flips are left: expand all of them at once against the current
+      // window and then consume their values in order.
+      FixedVector<ChessMove, kMaxFlips> flips;
+      for (ChessMove f = v; !f.IsNull(); f = picker.Next()) flips.push_back(f);
+      Count(&SearchStats::chance_nodes, flips.size());
+      std::array<float, kMaxFlips> values;
+      ParallelChanceSearch(std::max(alpha, score), beta, depth, color, flips,
+                           nullptr, nullptr, values.data());
+      // The values of a cut search are meaningless and must not reach the
+      // table.
+      if (search_cut_) return -kInf;
+      for (size_t i = 0; i < flips.size(); ++i) {
+        if (values[i] > score) {
+          score = values[i];
+          opt = flips[i];
+          if (save_move) best_move_ = flips[i];
+        }
+        if (score >= beta) {
+          Count(&SearchStats::beta_cutoffs);
+          if (num_moves == 1 && i == 0)
+            Count(&SearchStats::first_move_cutoffs);
+          table_.Store(hv, LOWER_BOUND, score, depth, flips[i]);
+          return score;
+        }
+      }
+      break;
+    }
+    if (v.IsFlip()) {
+      float t = ChanceNodeSearch(std::max(alpha, score), beta, depth, color,
+                                 v.GetPos());
+      if (search_cut_) return -kInf;
+      if (t > score) {
+        score = t;
+        opt = v;
+        if (save_move) best_move_ = v;
+      }
+    } else if (futile && picker.InQuietStage()) {
+      Count(&SearchStats::futility_prunes);
+      score = std::max(score, static_eval + kFutilityMargins[depth]);
+    } else {
+      const bool reduce = selective && features_.lmr && depth >= kLmrMinDepth &&
+                          num_moves > kLmrMinMoves && picker.InQuietStage();
+      const float bound = std::max(alpha, score);
+      MakeMove(v);
+      table_.Prefetch(GetBoard().GetHashValue());
+      float t = -kInf;
+      if (reduce) {
+        // Only a reduced move that beats the best one is searched fully.
+        Count(&SearchStats::reductions);
+        t = -NegaScout(-bound - 1, -bound, depth - 2, color ^ 1, false);
+      }
+      if (!reduce || t > bound)
+        t = -NegaScout(-upper_bound, -bound, depth - 1, color ^ 1, false);
+      if (search_cut_) {
+        Rewind();
+        return -kInf;
+      }
+      if (t > score) {  // failed-high
+        score = t;
+        opt = v;
+        if (save_move) best_move_ = v;
+        if (upper_bound != beta && depth >= 3 && t < beta) {
+          Count(&SearchStats::scout_researches);
+          score = -NegaScout(-beta, -t, depth - 1, color ^ 1, false);
+        }
+      }
+      Rewind();
+      if (search_cut_) return -kInf;
+    }
+    if (score >= beta) {
+      Count(&SearchStats::beta_cutoffs);
+      if (num_moves == 1) Count(&SearchStats::first_move_cutoffs);
+      if (!v.IsFlip() && GetBoard().GetPiece(v.GetDst()) == NO_PIECE)
+        UpdateQuietStats(v, ply, depth);
+      table_.Store(hv, LOWER_BOUND, score, depth, v);
+      return score;
+    }
+    upper_bound = std::max(score, alpha) + 1;
+  }
+
+  if (num_moves == 0) return -kWinScore * (depth + 1);
+  if (search_cut_) return -kInf;
+
+  Status flag = (score > alpha) ? EXACT_VALUE : UPPER_BOUND;
+  table_.Store(hv, flag, score, depth, opt);
+  return score;
+}
+
+std::pair<float, int> Searcher::SearchSingleDepth(float alpha, float beta,
+                                                  int depth) {
+  search_cut_ = false;
+  search_start_ = std::chrono::steady_clock::now();
+  auto saved_best_move = best_move_;
+  best_move_ = ChessMove();
+  float score = NegaScout(alpha, beta, depth, color_, true);
+  if (score <= alpha) {
+    Count(&SearchStats::aspiration_researches);
+    best_move_ = ChessMove();
+    score = NegaScout(-kInf, score, depth, color_, true);
+  } else if (score >= beta) {
+    Count(&SearchStats::aspiration_researches);
+    best_move_ = ChessMove();
+    score = NegaScout(score, kInf, depth, color_, true);
+  }
+  int time_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - search_start_)
+                         .count();
+  if (search_cut_) {
+    best_move_ = saved_best_move;
+  } else {
+    completed_depth_ = depth;
+    completed_score_ = score;
+    completed_move_ = best_move_;
+  }
+  return std::make_pair(score, time_elapsed);
+}
@@ -0,0 +1,295 @@
+// Plays engine A against engine B on all cores and reports the Elo of A.
+//
+// Games come in pairs sharing one random deal of the hidden pieces, seeded by
+// --seed and the pair index so that runs are reproducible, with each engine
+// moving first once; an odd --games is rounded up to a whole number of pairs.
+// Both engines are agents of this build, configured with the options of main:
+// --a=name=value,... and --b=name=value,... apply to one engine, every other
+// --name=value to both. With --sprt=elo0,elo1 the match stops as soon as the
+// sequential probability ratio test accepts either hypothesis. With
+// --positions=file, every position of the games once the colors are known is
+// appended to the file with the winner of its game, in the text format of
+// positions.h, for tune; with --records=file, to a position file of
+// positions.h instead.
+//
+// Usage: selfplay [--games=N] [--concurrency=T] [--seed=S] [--movetime=MS]
+//                 [--nodes=N] [--sprt=ELO0,ELO1] [--positions=FILE]
+//                 [--records=FILE] [--a=...] [--b=...]
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "agent.h"
+#include "chess.h"
+#include "positions.h"
+
+namespace {
+
+using Options = std::vector<std::pair<std::string, std::string>>;
+
+// The number of pieces of each kind of a color.
+constexpr std::array<uint8_t, kNumChessPieces> kNumPieces = {5, 2, 2, 2,
+                                                             2, 2, 1};
+
+// Appends the name=value pairs of a comma-separated list to *options.
+void ParseOptions(std::string_view list, Options *options) {
+  while (!list.empty()) {
+    const size_t comma = std::min(list.find(','), list.size());
+    const std::string_view option = list.substr(0, comma);
+    const size_t eq = option.find('=');
+    if (eq == std::string_view::npos) {
+      std::cerr << "Option without a value: " << option << std::endl;
+      exit(1);
+    }
+    options->emplace_back(option.substr(0, eq), option.substr(eq + 1));
+    list.remove_prefix(std::min(comma + 1, list.size()));
+  }
+}
+
+std::unique_ptr<Agent> MakeAgent(const Options &options) {
+  auto agent = std::make_unique<Agent>();
+  for (const auto &[name, value] : options) {
+    if (!agent->SetOption(name, value)) {
+      std::cerr << "Unsupported option: " << name << std::endl;
+      exit(1);
+    }
+  }
+  return agent;
+}
+
+// The hidden piece under each square in the deal of the pair of games.
+std::array<ChessPiece, 32> Deal(uint64_t seed, uint64_t pair) {
+  std::array<ChessPiece, 32> pieces;
+  size_t n = 0;
+  for (size_t piece = 0; piece < kNumChessPieces * 2; ++piece) {
+    for (int i = 0; i < kNumPieces[piece % kNumChessPieces]; ++i)
+      pieces[n++] = ChessPiece(piece);
+  }
+  std::seed_seq seq{static_cast<uint32_t>(seed),
+                    static_cast<uint32_t>(seed >> 32),
+                    static_cast<uint32_t>(pair),
+                    static_cast<uint32_t>(pair >> 32)};
+  std::mt19937_64 rng(seq);
+  std::shuffle(pieces.begin(), pieces.end(), rng);
+  return pieces;
+}
+
+// Plays a game between the engines built from options[0], who moves first,
+// and options[1]. Returns the winner: 0, 1, or 2 for a draw. Appends the
+// positions of the game to *positions unless it is null.
+int PlayGame(const std::array<Options, 2> &options,
+             const std::array<ChessPiece, 32> &deal,
+             std::vector<LabeledPosition> *positions) {
+  std::array<std::unique_ptr<Agent>, 2> agents = {MakeAgent(options[0]),
+                                                  MakeAgent(options[1])};
+  ChessBoard board;
+  // The engine playing each color, known after the first flip.
+  std::array<int, 2> engines{};
+  const size_t first = positions != nullptr ? positions->size() : 0;
+  auto label = [&](ChessColor winner) {
+    if (positions == nullptr) return;
+    for (size_t i = first; i < positions->size(); ++i)
+      (*positions)[i].winner = winner;
+  };
+  for (int turn = 0; !board.Terminate(); turn ^= 1) {
+    // A player who cannot move loses.
+    if (board.GetCurrentPlayer() != UNKNOWN &&
+        board.GetCoveredSquares() == 0 &&
+        board.ListMoves(board.GetCurrentPlayer()).empty()) {
+      label(board.GetCurrentPlayer() ^ 1);
+      return turn ^ 1;
+    }
+    if (positions != nullptr && board.GetCurrentPlayer() != UNKNOWN)
+      positions->push_back({board, DRAW});
+    const ChessMove mv = agents[turn]->GenerateMove();
+    if (!board.Playable(mv)) {
+      std::cout << "Engine " << "AB"[turn] << " played the illegal move "
+                << mv << std::endl;
+      // The positions of a forfeited game say nothing about their outcome.
+      if (positions != nullptr) positions->resize(first);
+      return turn ^ 1;
+    }
+    if (mv.IsFlip()) {
+      const ChessPiece result = deal[mv.GetPos()];
+      if (board.GetCurrentPlayer() == UNKNOWN) {
+        const ChessColor color = GetChessPieceColor(result);
+        engines[color] = turn;
+        engines[color ^ 1] = turn ^ 1;
+        agents[turn]->SetColor(color);
+        agents[turn ^ 1]->SetColor(ChessColor(color ^ 1));
+      }
+      board.MakeMove(Flip(mv.GetPos(), result));
+      for (auto &agent : agents) agent->MakeFlip(mv.GetPos(), result);
+    } else {
+      board.MakeMove(mv);
+      for (auto &agent : agents) agent->MakeMove(mv.GetSrc(), mv.GetDst());
+    }
+  }
+  const ChessColor winner = board.GetWinner();
+  label(winner);
+  return winner == DRAW ? 2 : engines[winner];
+}
+
+// The expected score of an engine stronger by elo.
+double EloToScore(double elo) { return 1 / (1 + std::pow(10, -elo / 400)); }
+double ScoreToElo(double score) {
+  score = std::clamp(score, 1e-6, 1 - 1e-6);
+  return -400 * std::log10(1 / score - 1);
+}
+
+struct Results {
+  // Wins, losses and draws of A.
+  std::array<uint64_t, 3> counts{};
+
+  uint64_t GetNumGames() const { return counts[0] + counts[1] + counts[2]; }
+  double GetScore() const {
+    return (counts[0] + counts[2] / 2.0) / GetNumGames();
+  }
+  // The variance of the result of a single game.
+  double GetVariance() const {
+    const double s = GetScore(), n = GetNumGames();
+    return (counts[0] * (1 - s) * (1 - s) + counts[1] * s * s +
+            counts[2] * (0.5 - s) * (0.5 - s)) /
+           n;
+  }
+  // The log-likelihood ratio of elo1 against elo0, in the normal
+  // approximation of the game results.
+  double GetLLR(double elo0, double elo1) const {
+    const double variance = GetVariance();
+    if (variance <= 0) return 0;
+    const double s0 = EloToScore(elo0), s1 = EloToScore(elo1);
+    return GetNumGames() * (s1 - s0) * (2 * GetScore() - s0 - s1) /
+           (2 * variance);
+  }
+};
+
+std::ostream &operator<<(std::ostream &os, const Results &results) {
+  const uint64_t n = results.GetNumGames();
+  const double s = results.GetScore();
+  // A 95% confidence interval.
+  const double margin = 1.96 * std::sqrt(results.GetVariance() / n);
+  const double elo = ScoreToElo(s);
+  return os << "games = " << n << " W/L/D = " << results.counts[0] << "/"
+            << results.counts[1] << "/" << results.counts[2]
+            << " score = " << s << " elo = " << elo << " +"
+            << ScoreToElo(s + margin) - elo << " -"
+            << elo - ScoreToElo(s - margin);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  uint64_t num_games = 100, seed = 1;
+  size_t concurrency = std::max(1U, std::thread::hardware_concurrency());
+  bool sprt = false;
+  double elo0 = 0, elo1 = 5;
+  const double alpha = 0.05, beta = 0.05;
+  std::array<Options, 2> options;
+  std::ofstream positions_file;
+  PositionWriter records_file;
+  options[0] = options[1] = {{"hash", "16"}, {"movetime", "100"}};
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    const size_t eq = arg.find('=');
+    if (arg.substr(0, 2) != "--" || eq == std::string_view::npos) {
+      std::cerr << "Unrecognized argument: " << arg << std::endl;
+      exit(1);
+    }
+    const std::string_view name = arg.substr(2, eq - 2);
+    const std::string value(arg.substr(eq + 1));
+    if (name == "games") {
+      num_games = std::stoull(value);
+    } else if (name == "concurrency") {
+      concurrency = std::max(1UL, std::stoul(value));
+    } else if (name == "seed") {
+      seed = std::stoull(value);
+    } else if (name == "sprt") {
+      const size_t comma = value.find(',');
+      if (comma == std::string::npos) {
+        std::cerr << "--sprt expects elo0,elo1" << std::endl;
+        exit(1);
+      }
+      sprt = true;
+      elo0 = std::stod(value);
+      elo1 = std::stod(value.substr(comma + 1));
+    } else if (name == "positions") {
+      positions_file.open(value, std::ios::app);
+      if (!positions_file) {
+        std::cerr << "Cannot open " << value << std::endl;
+        exit(1);
+      }
+    } else if (name == "records") {
+      if (!records_file.Open(value)) {
+        std::cerr << "Cannot open position file " << value << std::endl;
+        exit(1);
+      }
+    } else if (name == "a" || name == "b") {
+      ParseOptions(value, &options[name == "b"]);
+    } else {
+      for (auto &engine_options : options)
+        engine_options.emplace_back(name, value);
+    }
+  }
+  // The engines log every move; only the results are of interest here.
+  std::cerr.rdbuf(nullptr);
+
+  const double lower_bound = std::log(beta / (1 - alpha));
+  const double upper_bound = std::log((1 - beta) / alpha);
+  const uint64_t num_pairs = (num_games + 1) / 2;
+  std::atomic<uint64_t> next(0);
+  std::atomic<bool> stop(false);
+  std::mutex mutex;
+  Results results;
+  auto work = [&]() {
+    for (uint64_t pair;
+         !stop.load() && (pair = next.fetch_add(1)) < num_pairs;) {
+      const auto deal = Deal(seed, pair);
+      std::vector<LabeledPosition> positions;
+      auto *dump = positions_file.is_open() || records_file.IsOpen()
+                       ? &positions
+                       : nullptr;
+      // A moves first, then B.
+      const int first = PlayGame(options, deal, dump);
+      const int second = PlayGame({options[1], options[0]}, deal, dump);
+      std::lock_guard lock(mutex);
+      for (const auto &position : positions) {
+        if (positions_file.is_open()) positions_file << position << "\n";
+        if (records_file.IsOpen()) records_file.Write(PositionRecord(position));
+      }
+      ++results.counts[first];
+      ++results.counts[second == 2 ? 2 : second ^ 1];
+      if (results.GetNumGames() % 20 == 0) std::cout << results << std::endl;
+      if (sprt) {
+        const double llr = results.GetLLR(elo0, elo1);
+        if (llr <= lower_bound || llr >= upper_bound) {
+          std::cout << "SPRT: H" << (llr >= upper_bound) << " accepted, llr = "
+                    << llr << std::endl;
+          stop.store(true);
+        }
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < concurrency; ++i) threads.emplace_back(work);
+  work();
+  for (auto &thread : threads) thread.join();
+
+  std::cout << results << std::endl;
+  if (sprt) {
+    std::cout << "llr = " << results.GetLLR(elo0, elo1) << " bounds = ["
+              << lower_bound << ", " << upper_bound << "]" << std::endl;
+  }
+  return 0;
+}
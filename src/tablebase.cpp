@@ -0,0 +1,173 @@
+#include "tablebase.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+namespace {
+
+constexpr auto kPieceCharMapping = BuildPieceCharMapping();
+
+// Red pieces first, then by decreasing kind.
+constexpr int GetOrder(ChessPiece piece) {
+  return GetChessPieceColor(piece) * kNumChessPieces + GENERAL -
+         GetChessPieceType(piece);
+}
+
+constexpr ChessPiece SwapColor(ChessPiece piece) {
+  return ChessPiece(GetChessPieceColor(piece) == RED ? piece + kNumChessPieces
+                                                     : piece - kNumChessPieces);
+}
+
+}  // namespace
+
+Tablebase::Tablebase() : max_pieces_(0) {}
+
+Tablebase::~Tablebase() {
+  for (auto [addr, size] : mappings_) munmap(addr, size);
+}
+
+bool Tablebase::IsCanonical(const Material &material) {
+  FixedVector<ChessPiece, kMaxPieces> kinds[2];
+  for (ChessPiece piece : material)
+    kinds[GetChessPieceColor(piece)].push_back(GetChessPieceType(piece));
+  if (kinds[RED].size() != kinds[BLACK].size())
+    return kinds[RED].size() > kinds[BLACK].size();
+  return !std::lexicographical_compare(kinds[RED].begin(), kinds[RED].end(),
+                                       kinds[BLACK].begin(),
+                                       kinds[BLACK].end());
+}
+
+uint64_t Tablebase::GetKey(const Material &material) {
+  uint64_t key = 0;
+  for (ChessPiece piece : material) key = key << 4 | (piece + 1);
+  return key;
+}
+
+std::string Tablebase::GetFileName(const Material &material) {
+  std::string name;
+  for (ChessPiece piece : material) name += kPieceCharMapping[piece];
+  return name + ".tb";
+}
+
+size_t Tablebase::GetIndex(const Material &material, Squares squares,
+                           ChessColor player) {
+  size_t index = player;
+  for (size_t i = 0; i < material.size(); ++i) {
+    // Identical pieces are ordered by square.
+    for (size_t j = i; j > 0 && material[j - 1] == material[j] &&
+                       squares[j - 1] > squares[j];
+         --j) {
+      std::swap(squares[j - 1], squares[j]);
+    }
+  }
+  for (size_t i = 0; i < material.size(); ++i) index = index << 5 | squares[i];
+  return index;
+}
+
+bool Tablebase::GetIndex(const ChessBoard &board, ChessColor player,
+                         Material *material, size_t *index) {
+  if (board.GetCoveredSquares() != 0) return false;
+  uint32_t occupied =
+      board.GetUncoveredSquares(RED) | board.GetUncoveredSquares(BLACK);
+  const size_t num_pieces = __builtin_popcount(occupied);
+  if (num_pieces > kMaxPieces) return false;
+
+  std::array<std::pair<ChessPiece, uint8_t>, kMaxPieces> pieces;
+  for (size_t i = 0; occupied > 0; occupied &= occupied - 1, ++i) {
+    const uint8_t pos = __builtin_ctz(occupied);
+    pieces[i] = {board.GetPiece(pos), pos};
+  }
+  auto sort_pieces = [&]() {
+    for (size_t i = 1; i < num_pieces; ++i) {
+      for (size_t j = i;
+           j > 0 && GetOrder(pieces[j - 1].first) > GetOrder(pieces[j].first);
+           --j) {
+        std::swap(pieces[j - 1], pieces[j]);
+      }
+    }
+    material->clear();
+    for (size_t i = 0; i < num_pieces; ++i)
+      material->push_back(pieces[i].first);
+  };
+  sort_pieces();
+  if (!IsCanonical(*material)) {
+    for (size_t i = 0; i < num_pieces; ++i)
+      pieces[i].first = SwapColor(pieces[i].first);
+    player ^= 1;
+    sort_pieces();
+  }
+  Squares squares{};
+  for (size_t i = 0; i < num_pieces; ++i) squares[i] = pieces[i].second;
+  *index = GetIndex(*material, squares, player);
+  return true;
+}
+
+size_t Tablebase::Load(const std::string &dir) {
+  size_t count = 0;
+  std::error_code error;
+  for (const auto &entry : std::filesystem::directory_iterator(dir, error)) {
+    if (entry.path().extension() != ".tb") continue;
+    const int fd = open(entry.path().c_str(), O_RDONLY);
+    if (fd < 0) continue;
+    struct stat st;
+    void *addr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (addr == MAP_FAILED) continue;
+    const size_t size = st.st_size;
+    const auto *data = static_cast<const uint8_t *>(addr);
+
+    Material material;
+    bool valid = size >= kHeaderSize &&
+                 std::memcmp(data, kMagic, sizeof(kMagic)) == 0 &&
+                 data[4] >= 2 && data[4] <= kMaxPieces;
+    for (size_t i = 0; valid && i < data[4]; ++i) {
+      valid = data[5 + i] < kNumChessPieces * 2;
+      material.push_back(ChessPiece(data[5 + i]));
+    }
+    valid = valid && IsCanonical(material) &&
+            size == kHeaderSize + GetTableSize(material.size());
+    if (!valid) {
+      std::cerr << "Invalid tablebase file: " << entry.path() << std::endl;
+      munmap(addr, size);
+      continue;
+    }
+    // Probes jump around the table.
+    madvise(addr, size, MADV_RANDOM);
+    mappings_.emplace_back(addr, size);
+    Add(material, data + kHeaderSize);
+    ++count;
+  }
+  return count;
+}
+
+void Tablebase::Add(const Material &material, const uint8_t *data) {
+  assert(IsCanonical(material));
+  tables_[GetKey(material)] = data;
+  max_pieces_ = std::max(max_pieces_, material.size());
+}
+
+bool Tablebase::Probe(const ChessBoard &board, ChessColor player,
+                      uint8_t *value) const {
+  if (max_pieces_ == 0 || board.GetCoveredSquares() != 0) return false;
+  const size_t num_pieces = __builtin_popcount(
+      board.GetUncoveredSquares(RED) | board.GetUncoveredSquares(BLACK));
+  if (num_pieces > max_pieces_) return false;
+  Material material;
+  size_t index;
+  if (!GetIndex(board, player, &material, &index)) return false;
+  auto it = tables_.find(GetKey(material));
+  if (it == tables_.end()) return false;
+  *value = it->second[index];
+  return true;
+}
@@ -0,0 +1,75 @@
+#include "task_pool.h"
+
+#include <algorithm>
+#include <chrono>
+
+TaskPool::TaskPool(size_t num_workers, size_t num_external) : quit_(false) {
+  for (size_t i = 0; i < num_workers + num_external; ++i)
+    queues_.push_back(std::make_unique<Queue>());
+  for (size_t i = 0; i < num_workers; ++i)
+    workers_.emplace_back(&TaskPool::WorkerLoop, this, i);
+}
+
+TaskPool::~TaskPool() {
+  quit_.store(true);
+  wake_up_.notify_all();
+  for (auto &worker : workers_) worker.join();
+}
+
+void TaskPool::Push(size_t queue, Job *job) {
+  {
+    std::lock_guard<std::mutex> lock(queues_[queue]->mutex);
+    queues_[queue]->jobs.push_back(job);
+  }
+  wake_up_.notify_all();
+}
+
+void TaskPool::Remove(size_t queue, Job *job) {
+  {
+    std::lock_guard<std::mutex> lock(queues_[queue]->mutex);
+    auto &jobs = queues_[queue]->jobs;
+    jobs.erase(std::find(jobs.begin(), jobs.end(), job));
+  }
+  while (job->users_.load(std::memory_order_acquire) > 0)
+    std::this_thread::yield();
+}
+
+TaskPool::Job *TaskPool::Acquire(size_t worker) {
+  {
+    std::lock_guard<std::mutex> lock(queues_[worker]->mutex);
+    auto &jobs = queues_[worker]->jobs;
+    for (auto it = jobs.rbegin(); it != jobs.rend(); ++it) {
+      if ((*it)->HasWork()) {
+        (*it)->users_.fetch_add(1, std::memory_order_relaxed);
+        return *it;
+      }
+    }
+  }
+  for (size_t k = 1; k < queues_.size(); ++k) {
+    auto &queue = *queues_[(worker + k) % queues_.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    for (Job *job : queue.jobs) {
+      if (job->HasWork()) {
+        job->users_.fetch_add(1, std::memory_order_relaxed);
+        return job;
+      }
+    }
+  }
+  return nullptr;
+}
+
+void TaskPool::WorkerLoop(size_t worker) {
+  while (!quit_.load()) {
+    Job *job = Acquire(worker);
+    if (job == nullptr) {
+      // Jobs whose units are all claimed stay queued until their owners
+      // finish, so sleep briefly rather than waiting for a notification.
+      std::unique_lock<std::mutex> lock(sleep_mutex_);
+      wake_up_.wait_for(lock, std::chrono::microseconds(200));
+      continue;
+    }
+    while (job->RunOne(worker)) {
+    }
+    job->users_.fetch_sub(1, std::memory_order_release);
+  }
+}
@@ -0,0 +1,234 @@
+// Generates the endgame tablebases of the fully revealed positions with up to
+// --pieces pieces into --dir, smallest materials first so that the tables
+// reached by a capture are always solved before they are needed.
+
+#include <algorithm>
+#include <cassert>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chess.h"
+#include "tablebase.h"
+
+namespace {
+
+using Material = Tablebase::Material;
+using Squares = Tablebase::Squares;
+
+// The number of pieces of each kind of a color.
+constexpr std::array<uint8_t, kNumChessPieces> kNumPieces = {5, 2, 2, 2,
+                                                             2, 2, 1};
+constexpr auto kNeighborMasks = BuildNeighborMasks();
+
+// Appends to *out every set of num pieces of the color made of kinds up to
+// max_kind, extending *prefix by decreasing kind.
+void ListPieces(ChessColor color, size_t num, int max_kind, Material *prefix,
+                std::vector<Material> *out) {
+  if (num == 0) {
+    out->push_back(*prefix);
+    return;
+  }
+  for (int kind = max_kind; kind >= 0; --kind) {
+    const auto piece = ChessPiece(color * kNumChessPieces + kind);
+    if (std::count(prefix->begin(), prefix->end(), piece) >= kNumPieces[kind])
+      continue;
+    prefix->push_back(piece);
+    ListPieces(color, num - 1, kind, prefix, out);
+    prefix->pop_back();
+  }
+}
+
+// Decodes an index of the table of material. Returns false if the index is
+// not that of a position: two pieces share a square, or identical pieces are
+// out of order.
+bool Decode(const Material &material, size_t index, Squares *squares,
+            ChessColor *player) {
+  for (size_t i = material.size(); i-- > 0; index >>= 5)
+    (*squares)[i] = index & 31;
+  *player = ChessColor(index);
+  uint32_t occupied = 0;
+  for (size_t i = 0; i < material.size(); ++i) {
+    if (occupied >> (*squares)[i] & 1) return false;
+    occupied |= 1U << (*squares)[i];
+    if (i > 0 && material[i] == material[i - 1] &&
+        (*squares)[i] < (*squares)[i - 1]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+ChessBoard MakeBoard(const Material &material, const Squares &squares,
+                     ChessColor player) {
+  std::array<ChessPiece, 32> board;
+  board.fill(NO_PIECE);
+  for (size_t i = 0; i < material.size(); ++i) board[squares[i]] = material[i];
+  return ChessBoard(board, {}, player);
+}
+
+// Solves the table of material by retrograde analysis, given the tables of
+// the materials left after a capture.
+std::vector<uint8_t> Solve(const Material &material,
+                           const Tablebase &tablebase) {
+  constexpr uint8_t kDraw = Tablebase::kDraw;
+  const size_t size = Tablebase::GetTableSize(material.size());
+  std::vector<uint8_t> table(size, kDraw);
+  // The non-capturing moves whose child is not known to be lost yet.
+  std::vector<uint8_t> num_quiets(size, 0);
+  // The distance of the loss if every move turns out to lose.
+  std::vector<uint8_t> loss_distance(size, 0);
+  // Whether a capture avoids losing.
+  std::vector<bool> can_hold(size, false);
+  // The positions to be resolved at each distance.
+  std::vector<std::vector<uint32_t>> pending(kDraw);
+
+  for (size_t index = 0; index < size; ++index) {
+    Squares squares;
+    ChessColor player;
+    if (!Decode(material, index, &squares, &player)) continue;
+    const ChessBoard board = MakeBoard(material, squares, player);
+    MoveList moves;
+    board.ListCaptures(player, &moves);
+    uint8_t win_distance = kDraw;
+    for (ChessMove mv : moves) {
+      ChessBoard child = board;
+      child.MakeMove(mv);
+      uint8_t value = 0;  // The opponent has no pieces left.
+      if (!child.Terminate()) {
+        [[maybe_unused]] bool found =
+            tablebase.Probe(child, player ^ 1, &value);
+        assert(found);
+      }
+      if (value == kDraw || value + 1 == kDraw) {
+        can_hold[index] = true;
+      } else if (value % 2 == 0) {
+        can_hold[index] = true;
+        win_distance = std::min<uint8_t>(win_distance, value + 1);
+      } else {
+        loss_distance[index] =
+            std::max<uint8_t>(loss_distance[index], value + 1);
+      }
+    }
+    const size_t num_captures = moves.size();
+    board.ListQuiets(player, &moves);
+    num_quiets[index] = moves.size() - num_captures;
+    if (win_distance != kDraw) {
+      pending[win_distance].push_back(index);
+    } else if (num_quiets[index] == 0 && !can_hold[index]) {
+      pending[loss_distance[index]].push_back(index);
+    }
+  }
+
+  // Resolve the positions by increasing distance, which makes every win as
+  // short and every loss as long as possible.
+  for (size_t distance = 0; distance < kDraw; ++distance) {
+    for (size_t k = 0; k < pending[distance].size(); ++k) {
+      const uint32_t index = pending[distance][k];
+      if (table[index] != kDraw) continue;
+      table[index] = distance;
+      if (distance + 1 == kDraw) continue;
+
+      // Take back the non-capturing moves of the opponent.
+      Squares squares;
+      ChessColor player;
+      Decode(material, index, &squares, &player);
+      uint32_t occupied = 0;
+      for (size_t i = 0; i < material.size(); ++i) occupied |= 1U << squares[i];
+      for (size_t i = 0; i < material.size(); ++i) {
+        if (GetChessPieceColor(material[i]) == player) continue;
+        for (uint32_t from = kNeighborMasks[squares[i]] & ~occupied; from > 0;
+             from &= from - 1) {
+          Squares prev = squares;
+          prev[i] = __builtin_ctz(from);
+          const size_t parent = Tablebase::GetIndex(material, prev, player ^ 1);
+          if (table[parent] != kDraw) continue;
+          if (distance % 2 == 0) {
+            // The opponent wins by moving here.
+            pending[distance + 1].push_back(parent);
+          } else {
+            loss_distance[parent] = std::max<uint8_t>(loss_distance[parent],
+                                                      distance + 1);
+            if (--num_quiets[parent] == 0 && !can_hold[parent])
+              pending[loss_distance[parent]].push_back(parent);
+          }
+        }
+      }
+    }
+  }
+  return table;
+}
+
+void Write(const std::string &path, const Material &material,
+           const std::vector<uint8_t> &table) {
+  std::array<char, Tablebase::kHeaderSize> header{};
+  std::copy(std::begin(Tablebase::kMagic), std::end(Tablebase::kMagic),
+            header.begin());
+  header[4] = material.size();
+  for (size_t i = 0; i < material.size(); ++i) header[5 + i] = material[i];
+  std::ofstream out(path, std::ios::binary);
+  out.write(header.data(), header.size());
+  out.write(reinterpret_cast<const char *>(table.data()), table.size());
+  if (!out) {
+    std::cerr << "Cannot write " << path << std::endl;
+    exit(1);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  size_t max_pieces = 3;
+  std::string dir = ".";
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg.substr(0, 9) == "--pieces=") {
+      max_pieces = std::stoul(std::string(arg.substr(9)));
+    } else if (arg.substr(0, 6) == "--dir=") {
+      dir = arg.substr(6);
+    } else {
+      std::cerr << "Unrecognized argument: " << arg << std::endl;
+      exit(1);
+    }
+  }
+  if (max_pieces < 2 || max_pieces > Tablebase::kMaxPieces) {
+    std::cerr << "--pieces must be within [2, " << Tablebase::kMaxPieces << "]"
+              << std::endl;
+    exit(1);
+  }
+  std::filesystem::create_directories(dir);
+
+  Tablebase tablebase;
+  std::vector<std::vector<uint8_t>> tables;
+  for (size_t n = 2; n <= max_pieces; ++n) {
+    for (size_t num_red = 1; num_red < n; ++num_red) {
+      std::vector<Material> reds, blacks;
+      Material prefix;
+      ListPieces(RED, num_red, GENERAL, &prefix, &reds);
+      ListPieces(BLACK, n - num_red, GENERAL, &prefix, &blacks);
+      for (const Material &red : reds) {
+        for (const Material &black : blacks) {
+          Material material = red;
+          for (ChessPiece piece : black) material.push_back(piece);
+          if (!Tablebase::IsCanonical(material)) continue;
+
+          tables.push_back(Solve(material, tablebase));
+          tablebase.Add(material, tables.back().data());
+          const std::string name = Tablebase::GetFileName(material);
+          Write(dir + "/" + name, material, tables.back());
+
+          size_t num_wins = 0, num_losses = 0;
+          for (uint8_t v : tables.back()) {
+            if (v != Tablebase::kDraw) ++(v % 2 ? num_wins : num_losses);
+          }
+          std::cout << name << ": " << num_wins << " wins, " << num_losses
+                    << " losses" << std::endl;
+        }
+      }
+    }
+  }
+  return 0;
+}
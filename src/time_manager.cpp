@@ -0,0 +1,82 @@
+#include "time_manager.h"
+
+#include <algorithm>
+
+TimeManager::TimeManager()
+    : soft_limit_(kNoClockSoftLimitMs),
+      hard_limit_(kNoClockHardLimitMs),
+      move_time_(0),
+      last_iteration_(0),
+      prev_iteration_(0),
+      instability_(0),
+      cancelled_(false) {}
+
+TimeManager::~TimeManager() { Stop(); }
+
+void TimeManager::Start(int time_left, int num_covered,
+                        std::atomic<bool> *stop) {
+  Stop();
+  start_ = Clock::now();
+  last_iteration_ = prev_iteration_ = 0;
+  last_best_move_ = ChessMove();
+  instability_ = 0;
+  if (move_time_ > 0) {
+    soft_limit_ = hard_limit_ = move_time_;
+  } else if (time_left <= 0) {
+    soft_limit_ = kNoClockSoftLimitMs;
+    hard_limit_ = kNoClockHardLimitMs;
+  } else {
+    // Flips early in the game decide less than the fights that follow, so
+    // the covered pieces stretch the budget over more moves.
+    const float moves_to_go = kMovesToGo + kMovesPerCovered * num_covered;
+    soft_limit_ = static_cast<int>(time_left / moves_to_go);
+    hard_limit_ =
+        std::min(soft_limit_ * kMaxRatio, time_left / kMaxShare) - kMarginMs;
+    hard_limit_ = std::max(hard_limit_, 1);
+    soft_limit_ = std::min(soft_limit_, hard_limit_);
+  }
+  cancelled_ = false;
+  timer_ = std::thread(&TimeManager::RunTimer, this, stop);
+}
+
+void TimeManager::RunTimer(std::atomic<bool> *stop) {
+  std::unique_lock lock(mutex_);
+  const auto deadline = start_ + std::chrono::milliseconds(hard_limit_);
+  if (!cv_.wait_until(lock, deadline, [this] { return cancelled_; }))
+    stop->store(true, std::memory_order_relaxed);
+}
+
+void TimeManager::Stop() {
+  if (!timer_.joinable()) return;
+  {
+    std::lock_guard lock(mutex_);
+    cancelled_ = true;
+  }
+  cv_.notify_all();
+  timer_.join();
+}
+
+bool TimeManager::ShouldDeepen(int elapsed, ChessMove best_move) {
+  prev_iteration_ = last_iteration_;
+  last_iteration_ = elapsed;
+  const bool changed =
+      !last_best_move_.IsNull() && best_move != last_best_move_;
+  instability_ = instability_ / 2 + (changed ? 1 : 0);
+  last_best_move_ = best_move;
+
+  // Iterations shorter than a millisecond say nothing about the growth.
+  const float branching =
+      prev_iteration_ > 0
+          ? std::clamp(static_cast<float>(last_iteration_) / prev_iteration_,
+                       kMinBranching, kMaxBranching)
+          : kDefaultBranching;
+  const float budget =
+      std::min<float>(soft_limit_ * (1 + instability_ / 2), hard_limit_);
+  return GetElapsed() + last_iteration_ * branching <= budget;
+}
+
+int TimeManager::GetElapsed() const {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() -
+                                                               start_)
+      .count();
+}
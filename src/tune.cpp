@@ -0,0 +1,269 @@
+// Tunes the weights of ChessBoard::Evaluate to the outcomes of games, in the
+// way of Texel: the evaluation of each position, squashed by a sigmoid, is
+// fitted to the score of RED in its game by minimizing the mean squared error.
+// The scale of the sigmoid is fitted first with the current weights, then the
+// weights are fitted by Adam on the full batch, with a step relative to the
+// size of each weight. Positions are read from stdin in the text format of
+// positions.h, which selfplay writes with --positions, or with --records from
+// a position file, which selfplay writes with --records, and spread over all
+// cores. The tuned weights are printed as the constants of ChessBoard.
+//
+// Usage: tune [--threads=T] [--iterations=N] [--rate=R]
+//             [--records=FILE | < positions]
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "batch_eval.h"
+#include "chess.h"
+#include "positions.h"
+
+namespace {
+
+using Gradient = std::array<double, EvalWeights::kNumWeights>;
+
+// The positions one thread owns.
+struct Shard {
+  BatchEvaluator batch;
+  // The score of RED in the game of each position: 1, 0.5 or 0.
+  std::vector<float> results;
+  std::vector<float> scores, derivatives;
+  uint64_t num_malformed = 0;
+  // The sums over the shard of the errors and of their gradient.
+  double loss = 0;
+  Gradient gradient{};
+};
+
+// Runs f on every shard, each on its own thread.
+template <class F>
+void ForEachShard(std::vector<Shard> *shards, F f) {
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < shards->size(); ++i)
+    threads.emplace_back(f, &(*shards)[i]);
+  f(&(*shards)[0]);
+  for (auto &thread : threads) thread.join();
+}
+
+void Add(const LabeledPosition &position, Shard *shard) {
+  shard->batch.Add(position.board);
+  shard->results.push_back(position.winner == RED     ? 1
+                           : position.winner == BLACK ? 0
+                                                      : 0.5);
+}
+
+void Parse(std::string_view text, Shard *shard) {
+  std::istringstream is{std::string(text)};
+  for (std::string line; std::getline(is, line);) {
+    if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+    std::istringstream line_stream(line);
+    LabeledPosition position;
+    if (!ReadPosition(line_stream, &position)) {
+      ++shard->num_malformed;
+      continue;
+    }
+    Add(position, shard);
+  }
+}
+
+void Load(const PositionRecord *begin, const PositionRecord *end,
+          Shard *shard) {
+  LabeledPosition position;
+  for (const PositionRecord *record = begin; record != end; ++record) {
+    if (!record->GetPosition(&position)) {
+      ++shard->num_malformed;
+      continue;
+    }
+    Add(position, shard);
+  }
+}
+
+// Reads the positions of stdin, every shard parsing the lines that start in
+// its share of the text.
+void ParseInput(std::vector<Shard> *shards) {
+  const std::string text(std::istreambuf_iterator<char>(std::cin), {});
+  const size_t num_threads = shards->size();
+  std::vector<size_t> bounds(num_threads + 1, text.size());
+  bounds[0] = 0;
+  for (size_t i = 1; i < num_threads; ++i) {
+    const size_t newline = text.find('\n', text.size() * i / num_threads);
+    bounds[i] = newline == std::string::npos ? text.size() : newline + 1;
+  }
+  ForEachShard(shards, [&](Shard *shard) {
+    const size_t i = shard - shards->data();
+    Parse(std::string_view(text.data() + bounds[i], bounds[i + 1] - bounds[i]),
+          shard);
+  });
+}
+
+// Computes the loss of the shard, with its gradient if asked to, for the
+// sigmoid 1 / (1 + exp(-k * score)).
+void ComputeLoss(const EvalWeights &weights, float k, bool gradient,
+                 Shard *shard) {
+  const size_t n = shard->results.size();
+  shard->batch.Evaluate(weights, 0, n, shard->scores.data());
+  double loss = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const float p = 1 / (1 + std::exp(-k * shard->scores[i]));
+    const float error = p - shard->results[i];
+    loss += error * error;
+    shard->derivatives[i] = 2 * error * p * (1 - p) * k;
+  }
+  shard->loss = loss;
+  if (gradient) {
+    shard->gradient.fill(0);
+    shard->batch.AddGradient(weights, 0, n, shard->derivatives.data(),
+                             &shard->gradient);
+  }
+}
+
+// The mean loss over all positions, and its gradient if asked for.
+double ComputeLoss(const EvalWeights &weights, double k, uint64_t num_positions,
+                   std::vector<Shard> *shards, Gradient *gradient = nullptr) {
+  ForEachShard(shards, [&](Shard *shard) {
+    ComputeLoss(weights, k, gradient != nullptr, shard);
+  });
+  double loss = 0;
+  if (gradient != nullptr) gradient->fill(0);
+  for (const Shard &shard : *shards) {
+    loss += shard.loss;
+    if (gradient == nullptr) continue;
+    for (size_t j = 0; j < gradient->size(); ++j)
+      (*gradient)[j] += shard.gradient[j] / num_positions;
+  }
+  return loss / num_positions;
+}
+
+// The scale of the sigmoid that fits the weights best, by a golden-section
+// search over its logarithm.
+double FitScale(const EvalWeights &weights, uint64_t num_positions,
+                std::vector<Shard> *shards) {
+  const double ratio = (std::sqrt(5.0) - 1) / 2;
+  double lo = std::log(1E-4), hi = std::log(1E-1);
+  auto loss = [&](double x) {
+    return ComputeLoss(weights, std::exp(x), num_positions, shards);
+  };
+  double x1 = hi - ratio * (hi - lo), x2 = lo + ratio * (hi - lo);
+  double f1 = loss(x1), f2 = loss(x2);
+  for (int i = 0; i < 40; ++i) {
+    if (f1 < f2) {
+      hi = x2;
+      x2 = x1;
+      f2 = f1;
+      x1 = hi - ratio * (hi - lo);
+      f1 = loss(x1);
+    } else {
+      lo = x1;
+      x1 = x2;
+      f1 = f2;
+      x2 = lo + ratio * (hi - lo);
+      f2 = loss(x2);
+    }
+  }
+  return std::exp((lo + hi) / 2);
+}
+
+double GetSeconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  size_t num_threads = std::max(1U, std::thread::hardware_concurrency());
+  uint64_t num_iterations = 1000;
+  double rate = 0.01;
+  std::string records;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg.substr(0, 10) == "--threads=") {
+      num_threads = std::max(1UL, std::stoul(std::string(arg.substr(10))));
+    } else if (arg.substr(0, 13) == "--iterations=") {
+      num_iterations = std::stoull(std::string(arg.substr(13)));
+    } else if (arg.substr(0, 7) == "--rate=") {
+      rate = std::stod(std::string(arg.substr(7)));
+    } else if (arg.substr(0, 10) == "--records=") {
+      records = arg.substr(10);
+    } else {
+      std::cerr << "Unrecognized argument: " << arg << std::endl;
+      exit(1);
+    }
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<Shard> shards(num_threads);
+  if (records.empty()) {
+    ParseInput(&shards);
+  } else {
+    PositionFile file;
+    if (!file.Load(records)) {
+      std::cerr << "Cannot load position file " << records << std::endl;
+      return 1;
+    }
+    file.ParallelFor(num_threads, [&](size_t i, size_t begin, size_t end) {
+      Load(file.begin() + begin, file.begin() + end, &shards[i]);
+    });
+  }
+  uint64_t num_positions = 0, num_malformed = 0;
+  for (Shard &shard : shards) {
+    shard.scores.resize(shard.results.size());
+    shard.derivatives.resize(shard.results.size());
+    num_positions += shard.results.size();
+    num_malformed += shard.num_malformed;
+  }
+  std::cout << "positions = " << num_positions
+            << " malformed = " << num_malformed
+            << " time = " << GetSeconds(start) << " s" << std::endl;
+  if (num_positions == 0) return 1;
+
+  EvalWeights weights = EvalWeights::Default();
+  const double k = FitScale(weights, num_positions, &shards);
+  std::cout << "k = " << k << " loss = "
+            << ComputeLoss(weights, k, num_positions, &shards)
+            << " time = " << GetSeconds(start) << " s" << std::endl;
+
+  // Adam on the weights relative to their initial values.
+  const EvalWeights initial = weights;
+  constexpr double kBeta1 = 0.9, kBeta2 = 0.999, kEpsilon = 1E-8;
+  Gradient m{}, v{}, gradient;
+  std::array<double, EvalWeights::kNumWeights> theta;
+  theta.fill(1);
+  for (uint64_t t = 1; t <= num_iterations; ++t) {
+    const double loss =
+        ComputeLoss(weights, k, num_positions, &shards, &gradient);
+    if (t % 100 == 0 || t == 1) {
+      std::cout << "iteration = " << t << " loss = " << loss
+                << " time = " << GetSeconds(start) << " s" << std::endl;
+    }
+    for (size_t j = 0; j < theta.size(); ++j) {
+      const double g = gradient[j] * initial.values[j];
+      m[j] = kBeta1 * m[j] + (1 - kBeta1) * g;
+      v[j] = kBeta2 * v[j] + (1 - kBeta2) * g * g;
+      const double m_hat = m[j] / (1 - std::pow(kBeta1, t));
+      const double v_hat = v[j] / (1 - std::pow(kBeta2, t));
+      theta[j] = std::max(0.0, theta[j] - rate * m_hat /
+                                              (std::sqrt(v_hat) + kEpsilon));
+      weights.values[j] = initial.values[j] * theta[j];
+    }
+    // Below 1, the coefficients would turn covered pieces and pieces under
+    // attack into gains.
+    for (size_t j : {EvalWeights::kCoefCovered, EvalWeights::kCoefDangerous}) {
+      weights.values[j] = std::max(1.0F, weights.values[j]);
+      theta[j] = weights.values[j] / initial.values[j];
+    }
+  }
+  std::cout << "loss = " << ComputeLoss(weights, k, num_positions, &shards)
+            << " time = " << GetSeconds(start) << " s\n"
+            << weights;
+  return 0;
+}